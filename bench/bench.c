@@ -0,0 +1,150 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include "log.h"
+#include "stats/clock.h"
+
+#define MIN_DURATION_NS 200000000U
+
+void *__real_malloc(usize size);
+void *__real_calloc(usize nmemb, usize size);
+void *__real_realloc(void *ptr, usize size);
+void __real_free(void *ptr);
+
+static uint_64 allocations = 0;
+static const char *failure = NULL;
+static bool failed = false;
+
+void *__wrap_malloc(const usize size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(const usize nmemb, const usize size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *const ptr, const usize size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *const ptr) {
+    __real_free(ptr);
+}
+
+struct worker {
+    bench_fn *fn;
+    void *ctx;
+    uint_64 iterations;
+};
+
+static void *run_worker(void *const arg) {
+    struct worker *worker = arg;
+
+    worker->fn(worker->ctx, worker->iterations);
+
+    return NULL;
+}
+
+static uint_64 run_once(bench_fn *const fn, void *const ctx, const uint_8 threads_num, const uint_64 iterations) {
+    pthread_t threads[UINT8_MAX];
+    struct worker worker = {.fn = fn, .ctx = ctx, .iterations = iterations};
+    uint_64 begin = clock_now_ns();
+
+    if (threads_num <= 1)
+        fn(ctx, iterations);
+    else {
+        for (uint_8 i = 0; i < threads_num; ++i)
+            pthread_create(&threads[i], NULL, run_worker, &worker);
+
+        for (uint_8 i = 0; i < threads_num; ++i)
+            pthread_join(threads[i], NULL);
+    }
+
+    return clock_now_ns() - begin;
+}
+
+void bench_fail(const char *const reason) {
+    __atomic_store_n(&failure, reason, __ATOMIC_RELAXED);
+}
+
+static bool run_failed(const char *const name) {
+    const char *reason = __atomic_exchange_n(&failure, NULL, __ATOMIC_RELAXED);
+
+    if (reason == NULL)
+        return false;
+
+    printf("%-44s FAILED: %s\n", name, reason);
+    fflush(stdout);
+    failed = true;
+
+    return true;
+}
+
+void bench_run_threads(const char *const name, bench_fn *const fn, void *const ctx, const uint_8 threads_num) {
+    uint_64 iterations = 1, elapsed, allocs, ops;
+
+    run_once(fn, ctx, threads_num, 1);
+
+    if (run_failed(name))
+        return;
+
+    while ((elapsed = run_once(fn, ctx, threads_num, iterations)) < MIN_DURATION_NS / 10 && iterations < (UINT64_C(1) << 40))
+        iterations *= 10;
+
+    if (run_failed(name))
+        return;
+
+    if (elapsed < MIN_DURATION_NS)
+        iterations = (uint_64) ((double) iterations * MIN_DURATION_NS / (double) (elapsed > 0 ? elapsed : 1));
+
+    allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    elapsed = run_once(fn, ctx, threads_num, iterations);
+    allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - allocs;
+    ops = iterations * (threads_num > 1 ? threads_num : 1);
+
+    if (run_failed(name))
+        return;
+
+    /* both per operation of any thread: ns/op is the wall time the whole run took over every operation it did */
+    printf("%-44s %12lu ops %12.1f ns/op %8.2f allocs/op\n", name, (unsigned long) ops,
+           (double) elapsed / (double) ops, (double) allocs / (double) ops);
+    fflush(stdout);
+}
+
+void bench_run(const char *const name, bench_fn *const fn, void *const ctx) {
+    bench_run_threads(name, fn, ctx, 1);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} suites[] = {
+        {"marshaller", bench_marshaller},
+        {"data",       bench_data},
+        {"service",    bench_service},
+        {"rh",         bench_rh}
+};
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    log_silence();
+
+    for (usize i = 0; i < sizeof(suites) / sizeof(suites[0]); ++i) {
+        bool selected = argc < 2;
+
+        for (int_32 j = 1; j < argc; ++j)
+            selected = selected || strcmp(argv[j], suites[i].name) == 0;
+
+        if (selected)
+            suites[i].run();
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_BENCH_H
+#define CSOCKET_BENCH_H
+
+#include "types/primitive.h"
+
+typedef void (bench_fn)(void *ctx, uint_64 iterations);
+
+void bench_run(const char *name, bench_fn *, void *ctx);
+
+void bench_run_threads(const char *name, bench_fn *, void *ctx, uint_8 threads_num);
+
+/* Called from a bench_fn that could not do its work: the run is reported as failed, without timings, and so is the suite */
+void bench_fail(const char *reason);
+
+void bench_marshaller(void);
+
+void bench_data(void);
+
+void bench_service(void);
+
+void bench_rh(void);
+
+/* Defined for the -Wl,--wrap linker flags of the bench target, which route every allocation through a counter */
+void *__wrap_malloc(usize size);
+void *__wrap_calloc(usize nmemb, usize size);
+void *__wrap_realloc(void *ptr, usize size);
+void __wrap_free(void *ptr);
+
+#endif /* CSOCKET_BENCH_H */
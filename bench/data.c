@@ -0,0 +1,58 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "bench.h"
+
+#include "m/data.h"
+
+static volatile usize sink;
+
+static void push_presized(void *const ctx __attribute__((unused)), const uint_64 iterations) {
+    uint_16 a = 20, b = 30;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        struct data *data = data_new(2);
+
+        data_push(data, UINT, sizeof(uint_16), &a);
+        data_push(data, UINT, sizeof(uint_16), &b);
+        data_destroy(data);
+    }
+}
+
+static void push_growing(void *const ctx __attribute__((unused)), const uint_64 iterations) {
+    uint_32 v = 42;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        struct data *data = data_new(1);
+
+        for (uint_8 j = 0; j < 32; ++j)
+            data_push(data, UINT, sizeof(uint_32), &v);
+
+        data_destroy(data);
+    }
+}
+
+static void get_value(void *const ctx, const uint_64 iterations) {
+    const struct data *data = ctx;
+    const struct value *value;
+    usize total = 0;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        for (uint_8 j = 0; (value = data_get_value(data, j)) != NULL; ++j)
+            total += value->size;
+    }
+
+    sink = total;
+}
+
+void bench_data(void) {
+    struct data *data = data_new(32);
+    uint_32 v = 42;
+
+    for (uint_8 j = 0; j < 32; ++j)
+        data_push(data, UINT, sizeof(uint_32), &v);
+
+    bench_run("data_push/2 values, presized", push_presized, NULL);
+    bench_run("data_push/32 values, growing", push_growing, NULL);
+    bench_run("data_get_value/32 values", get_value, data);
+
+    data_destroy(data);
+}
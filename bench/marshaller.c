@@ -0,0 +1,82 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "m/marshaller.h"
+
+struct payload {
+    const char *name;
+    struct data *data;
+    struct value bytes;
+};
+
+static void marshall_loop(void *const ctx, const uint_64 iterations) {
+    struct payload *payload = ctx;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        struct value bytes_value = {0};
+
+        marshall(payload->data, "calc", "add", &bytes_value);
+        marshall_free(&bytes_value);
+    }
+}
+
+static void unmarshall_loop(void *const ctx, const uint_64 iterations) {
+    struct payload *payload = ctx;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        char *service = NULL, *method = NULL;
+        struct data *data = NULL;
+
+        unmarshall(&payload->bytes, &service, &method, &data);
+        unmarshall_free(&service, &method, &data);
+    }
+}
+
+void bench_marshaller(void) {
+    static byte blob[255];
+    struct payload payloads[4] = {{.name = "calc (2 x uint_16)"},
+                                  {.name = "ints (8 x mixed width)"},
+                                  {.name = "bytes (1 x 255 B)"},
+                                  {.name = "bytes (16 x 64 B)"}};
+    uint_16 a = 20, b = 30;
+    uint_64 u64 = UINT64_MAX;
+    int_32 i32 = -1;
+    byte u8 = 1;
+    char name[64];
+
+    memset(blob, 0x5a, sizeof(blob));
+
+    payloads[0].data = data_new(2);
+    data_push(payloads[0].data, UINT, sizeof(uint_16), &a);
+    data_push(payloads[0].data, UINT, sizeof(uint_16), &b);
+
+    payloads[1].data = data_new(8);
+    for (uint_8 i = 0; i < 2; ++i) {
+        data_push(payloads[1].data, UINT, sizeof(byte), &u8);
+        data_push(payloads[1].data, UINT, sizeof(uint_16), &a);
+        data_push(payloads[1].data, INT, sizeof(int_32), &i32);
+        data_push(payloads[1].data, UINT, sizeof(uint_64), &u64);
+    }
+
+    payloads[2].data = data_new(1);
+    data_push(payloads[2].data, BYTES, sizeof(blob), blob);
+
+    payloads[3].data = data_new(16);
+    for (uint_8 i = 0; i < 16; ++i)
+        data_push(payloads[3].data, BYTES, 64, blob);
+
+    for (uint_8 i = 0; i < 4; ++i) {
+        marshall(payloads[i].data, "calc", "add", &payloads[i].bytes);
+
+        snprintf(name, sizeof(name), "marshall/%s", payloads[i].name);
+        bench_run(name, marshall_loop, &payloads[i]);
+
+        snprintf(name, sizeof(name), "unmarshall/%s", payloads[i].name);
+        bench_run(name, unmarshall_loop, &payloads[i]);
+
+        marshall_free(&payloads[i].bytes);
+        data_destroy(payloads[i].data);
+    }
+}
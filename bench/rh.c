@@ -0,0 +1,114 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rh/server.h"
+#include "rh/client.h"
+#include "rh/timer.h"
+
+#define BENCH_PORT 39151
+#define BENCH_TIMERS 100000
+
+static __attribute__((noreturn)) void *echo_server(void *const ctx) {
+    rh_server_ctx *server_ctx = ctx;
+    rh_client_msg *msg;
+
+    for (;;) {
+        if (NULL != (msg = rh_receive_from_client(server_ctx))) {
+            rh_send_to_client(msg->return_addr, msg->data, msg->data_size);
+            rh_client_msg_destroy(msg, false);
+        }
+    }
+}
+
+static void round_trip(void *const ctx, const uint_64 iterations) {
+    static const byte request[] = {'S', 4, 'c', 'a', 'l', 'c', 'M', 3, 'a', 'd', 'd', 'U', 2, 20, 0, 'U', 2, 30, 0};
+    rh_conn_ctx *conn_ctx = ctx;
+    rh_server_msg *msg;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        if (!rh_send_to_server(conn_ctx, request, sizeof(request))) {
+            bench_fail("send failed");
+            return;
+        }
+
+        if (NULL == (msg = rh_receive_from_server(conn_ctx))) {
+            bench_fail("receive failed");
+            return;
+        }
+
+        rh_server_msg_destroy(msg);
+    }
+}
+
+static void noop_timer(struct timer *timer __attribute__((unused)), void *arg __attribute__((unused))) {}
+
+/* Arms and cancels a timer among BENCH_TIMERS others, spread over the next minute */
+static void arm_cancel(void *const ctx, const uint_64 iterations) {
+    struct timer_wheel *wheel = ctx;
+    struct timer timer;
+
+    timer_init(&timer, noop_timer, NULL);
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        timer_arm(wheel, &timer, timer_wheel_now_ns(wheel) + (i % 60000U) * 1000000U);
+        timer_cancel(wheel, &timer);
+    }
+}
+
+static void bench_timers(void) {
+    struct timer_wheel *wheel = timer_wheel_new(0);
+    struct timer *timers = malloc(sizeof(struct timer) * BENCH_TIMERS);
+
+    for (uint_32 i = 0; i < BENCH_TIMERS; ++i) {
+        timer_init(&timers[i], noop_timer, NULL);
+        timer_arm(wheel, &timers[i], (uint_64) (rand() % 60000) * 1000000U);
+    }
+
+    bench_run("timer_arm+timer_cancel/100000 armed", arm_cancel, wheel);
+
+    timer_wheel_destroy(wheel);
+    free(timers);
+}
+
+void bench_rh(void) {
+    static const struct {
+        enum protocol protocol;
+        const char *name;
+        const char *path;
+    } transports[] = {
+            {TCP,       "rh_send+rh_receive/tcp loopback",   "127.0.0.1"},
+            {UDP,       "rh_send+rh_receive/udp loopback",   "127.0.0.1"},
+            {UNIX,      "rh_send+rh_receive/unix stream",    "/tmp/csocket-bench.sock"},
+            {SEQPACKET, "rh_send+rh_receive/unix seqpacket", "/tmp/csocket-bench-packet.sock"},
+            {SHM,       "rh_send+rh_receive/shm rings",      "/tmp/csocket-bench-shm.sock"}
+    };
+    rh_server_ctx *server_ctx;
+    rh_conn_ctx *conn_ctx;
+    pthread_t thread;
+
+    bench_timers();
+
+    for (uint_8 i = 0; i < sizeof(transports) / sizeof(transports[0]); ++i) {
+        const char *name = transports[i].name;
+
+        if (NULL == (server_ctx = rh_server_new(transports[i].protocol, BENCH_PORT + i, transports[i].path))) {
+            fprintf(stderr, "%s: failed to listen on %s port %u\n", name, transports[i].path, BENCH_PORT + i);
+            continue;
+        }
+
+        pthread_create(&thread, NULL, echo_server, server_ctx);
+        pthread_detach(thread);
+
+        if (NULL == (conn_ctx = rh_client_new(transports[i].protocol, transports[i].path, BENCH_PORT + i))) {
+            fprintf(stderr, "%s: failed to connect to %s port %u\n", name, transports[i].path, BENCH_PORT + i);
+            continue;
+        }
+
+        bench_run(name, round_trip, conn_ctx);
+
+        rh_client_destroy(conn_ctx);
+    }
+}
@@ -0,0 +1,63 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "bench.h"
+
+#include <stdio.h>
+#include "i/service.h"
+#include "i/queue.h"
+
+#define QUEUE_FLOWS 64
+
+static void noop(const data *d __attribute__((unused)), data *r __attribute__((unused))) {}
+
+static void acquire_release(void *const ctx, const uint_64 iterations) {
+    struct service *service = ctx;
+
+    for (uint_64 i = 0; i < iterations; ++i) {
+        struct service_instance *inst = service_get_instance(service);
+
+        if (service_get_method(inst, "div") == NULL)
+            return;
+
+        service_release_instance(service, inst);
+    }
+}
+
+/* Every request goes through the queue once: keep it full enough that the flows of the lanes take turns */
+static void queue_push_pop(void *const ctx, const uint_64 iterations) {
+    static struct queue_entry entries[QUEUE_FLOWS * 4];
+    struct queue *queue = ctx;
+
+    for (usize i = 0; i < sizeof(entries) / sizeof(entries[0]); ++i) {
+        entries[i].flow = i % QUEUE_FLOWS;
+        entries[i].lane = (uint_8) (i % QUEUE_LANES);
+        entries[i].weight = (uint_8) (1 + i % 3);
+        queue_push(queue, &entries[i]);
+    }
+
+    for (uint_64 i = 0; i < iterations; ++i)
+        queue_push(queue, queue_pop(queue));
+
+    for (usize i = 0; i < sizeof(entries) / sizeof(entries[0]); ++i)
+        queue_pop(queue);
+}
+
+void bench_service(void) {
+    static const uint_8 threads[] = {1, 2, 4, 8, 16};
+    struct service *service = service_new("calc", 4, 10);
+    struct queue *queue;
+    char name[64];
+
+    service_add_method(service, "add", noop, 0);
+    service_add_method(service, "sub", noop, 0);
+    service_add_method(service, "mul", noop, 0);
+    service_add_method(service, "div", noop, 0);
+
+    for (uint_8 i = 0; i < sizeof(threads); ++i) {
+        snprintf(name, sizeof(name), "service_get_instance+get_method/%u threads", threads[i]);
+        bench_run_threads(name, acquire_release, service, threads[i]);
+    }
+
+    queue = queue_new();
+    bench_run("queue_push+pop/64 flows", queue_push_pop, queue);
+    queue_destroy(queue);
+}
@@ -0,0 +1,328 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "c10k.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "log.h"
+#include "m/marshaller.h"
+#include "stats/clock.h"
+
+#define PENDING_CONNECTS_MAX 128
+#define EVENTS_MAX 1024
+#define SLOT_NS 1000000U
+
+enum conn_state {
+    CLOSED,
+    CONNECTING,
+    IDLE,
+    WAITING
+};
+
+struct conn {
+    int fd;
+    enum conn_state state;
+    uint_64 sent_at;
+};
+
+struct c10k {
+    int epoll_fd;
+    struct addrinfo *addr;
+    struct conn *conns;
+    uint_32 conns_count;
+    uint_32 pending;
+    uint_32 established;
+    struct value request;
+    struct bm_result *result;
+};
+
+static bool parse_number(const char *const str, const double max, double *const number) {
+    char *endptr;
+
+    *number = strtod(str, &endptr);
+
+    return *endptr == '\0' && endptr != str && *number > 0 && *number <= max;
+}
+
+/* CONNECTIONS[:step=N,rate=REQ_PER_SEC,duration=SEC,pid=SERVER_PID] */
+bool c10k_parse(const char *const spec, struct c10k_options *const options) {
+    char buffer[256], *option, *value, *saveptr = NULL;
+    double number;
+
+    if (strlen(spec) >= sizeof(buffer))
+        return false;
+
+    strcpy(buffer, spec);
+    memset(options, 0, sizeof(struct c10k_options));
+    options->rate = 1;
+    options->duration = 5;
+
+    if (NULL != (option = strchr(buffer, ':')))
+        *option++ = '\0';
+
+    if (!parse_number(buffer, 1000000, &number))
+        return false;
+
+    options->connections = (uint_32) number;
+    options->step = options->connections >= 10 ? options->connections / 10 : options->connections;
+
+    for (option = option ? strtok_r(option, ",", &saveptr) : NULL; option != NULL; option = strtok_r(NULL, ",", &saveptr)) {
+        if (NULL == (value = strchr(option, '=')))
+            return false;
+
+        *value++ = '\0';
+
+        if (!parse_number(value, 1000000, &number))
+            return false;
+
+        if (strcmp(option, "step") == 0)
+            options->step = (uint_32) number;
+        else if (strcmp(option, "rate") == 0)
+            options->rate = number;
+        else if (strcmp(option, "duration") == 0)
+            options->duration = (uint_32) number;
+        else if (strcmp(option, "pid") == 0)
+            options->server_pid = (int_32) number;
+        else
+            return false;
+    }
+
+    return options->step > 0;
+}
+
+static ssize rss_kb(const int_32 pid) {
+    char path[64], line[256];
+    ssize rss = -1;
+    FILE *status;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+
+    if (NULL == (status = fopen(path, "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(status);
+
+    return rss;
+}
+
+static void raise_fd_limit(const uint_32 connections) {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < connections + 64U) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+
+        if (limit.rlim_cur < connections + 64U)
+            log_print(WARN, "Open files limit is %lu, connections beyond it will fail", (unsigned long) limit.rlim_cur);
+    }
+}
+
+static void conn_close(struct c10k *const c10k, struct conn *const conn) {
+    if (conn->state == CONNECTING)
+        --c10k->pending;
+    else if (conn->state != CLOSED)
+        --c10k->established;
+
+    close(conn->fd);
+    conn->state = CLOSED;
+    ++c10k->result->errors;
+}
+
+static void conn_open(struct c10k *const c10k) {
+    struct conn *conn = &c10k->conns[c10k->conns_count];
+    struct epoll_event event = {.events = EPOLLOUT};
+    int fd;
+
+    if ((fd = socket(c10k->addr->ai_family, SOCK_STREAM, PF_UNSPEC)) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        log_error(WARN, errno, "socket()");
+
+        if (fd >= 0)
+            close(fd);
+
+        ++c10k->result->errors;
+        ++c10k->conns_count;
+        return;
+    }
+
+    conn->fd = fd;
+    conn->state = CONNECTING;
+    event.data.u32 = c10k->conns_count++;
+    ++c10k->pending;
+
+    if ((connect(fd, c10k->addr->ai_addr, c10k->addr->ai_addrlen) < 0 && errno != EINPROGRESS) ||
+        epoll_ctl(c10k->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        conn_close(c10k, conn);
+}
+
+static void conn_send(struct c10k *const c10k, struct conn *const conn) {
+    if (conn->state != IDLE)
+        return;
+
+    conn->sent_at = clock_now_ns();
+
+    if (write(conn->fd, c10k->request.value, c10k->request.size) != (ssize) c10k->request.size)
+        conn_close(c10k, conn);
+    else
+        conn->state = WAITING;
+}
+
+static void conn_event(struct c10k *const c10k, const uint_32 index, const uint_32 events) {
+    struct conn *conn = &c10k->conns[index];
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = index};
+    byte buffer[512];
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (conn->state == CONNECTING) {
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0 ||
+            epoll_ctl(c10k->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+            log_error(DEBUG, err, "connect()");
+            conn_close(c10k, conn);
+            return;
+        }
+
+        --c10k->pending;
+        ++c10k->established;
+        conn->state = IDLE;
+    } else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        if (read(conn->fd, buffer, sizeof(buffer)) <= 0 || conn->state != WAITING) {
+            conn_close(c10k, conn);
+            return;
+        }
+
+        histogram_record(c10k->result->histogram, clock_now_ns() - conn->sent_at);
+        conn->state = IDLE;
+    }
+}
+
+static void poll_events(struct c10k *const c10k, const int timeout_ms) {
+    struct epoll_event events[EVENTS_MAX];
+    int n = epoll_wait(c10k->epoll_fd, events, EVENTS_MAX, timeout_ms);
+
+    for (int i = 0; i < n; ++i)
+        conn_event(c10k, events[i].data.u32, events[i].events);
+}
+
+/* Connection i fires in slot (i % slots_count) of each period, so the load is spread evenly and each tick only
+ * touches the connections that are due */
+static void run_step(struct c10k *const c10k, const struct c10k_options *const options) {
+    const uint_64 period = (uint_64) (1e9 / options->rate);
+    const uint_32 slots_count = period / SLOT_NS > 0 ? (uint_32) (period / SLOT_NS) : 1;
+    const uint_64 started = clock_now_ns(), deadline = started + (uint_64) options->duration * 1000000000U;
+    uint_64 now, tick = 0, last_tick = 0;
+
+    for (now = started; now < deadline; now = clock_now_ns()) {
+        for (tick = (now - started) / SLOT_NS; last_tick <= tick; ++last_tick) {
+            for (uint_32 i = (uint_32) (last_tick % slots_count); i < c10k->conns_count; i += slots_count)
+                conn_send(c10k, &c10k->conns[i]);
+        }
+
+        poll_events(c10k, 1);
+    }
+}
+
+uint_8 c10k_run(const struct host_addr *const host_addr, const struct c10k_options *const options,
+                struct bm_result *const results, uint_8 *const results_count) {
+    struct c10k c10k = {0};
+    struct data *request = data_new(2);
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    char service_port[6], name[64];
+    uint_16 a = 20, b = 30;
+    uint_64 started, elapsed;
+    uint_32 target, previous;
+
+    if (host_addr->protocol != TCP) {
+        log_print(ERROR, "The connection scale benchmark requires a TCP service");
+        return EXIT_MISTAKE;
+    }
+
+    snprintf(service_port, sizeof(service_port), "%u", host_addr->port);
+
+    if (getaddrinfo(host_addr->address, service_port, &hints, &c10k.addr) != 0) {
+        log_print(ERROR, "%s: failed to resolve address", host_addr->address);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit(options->connections);
+
+    data_push(request, UINT, sizeof(uint_16), &a);
+    data_push(request, UINT, sizeof(uint_16), &b);
+    marshall(request, host_addr->service_name, "add", &c10k.request);
+    data_destroy(request);
+
+    /* connections write the request straight to their sockets, so it carries its own frame header */
+    c10k.request.value = realloc(c10k.request.value, c10k.request.size + RH_FRAME_HEADER);
+    memmove((byte *) c10k.request.value + RH_FRAME_HEADER, c10k.request.value, c10k.request.size);
+    ((byte *) c10k.request.value)[0] = (byte) (c10k.request.size >> 8U);
+    ((byte *) c10k.request.value)[1] = (byte) c10k.request.size;
+    c10k.request.size += RH_FRAME_HEADER;
+
+    c10k.epoll_fd = epoll_create1(0);
+    c10k.conns = calloc(options->connections, sizeof(struct conn));
+
+    for (target = options->step < options->connections ? options->step : options->connections; *results_count < UINT8_MAX;
+         target = target + options->step < options->connections ? target + options->step : options->connections) {
+        struct bm_result *result = &results[*results_count];
+
+        snprintf(name, sizeof(name), "c10k/%u", target);
+        result->name = strcpy(malloc(strlen(name) + 1), name);
+        result->requests = result->errors = 0;
+        result->histogram = histogram_new();
+        c10k.result = result;
+
+        log_print(INFO, "Ramping up to %u connections", target);
+
+        started = clock_now_ns();
+        previous = c10k.established;
+
+        while (c10k.conns_count < target || c10k.pending > 0) {
+            while (c10k.conns_count < target && c10k.pending < PENDING_CONNECTS_MAX)
+                conn_open(&c10k);
+
+            poll_events(&c10k, 10);
+        }
+
+        elapsed = clock_now_ns() - started;
+        result->connections = c10k.established;
+        result->accept_rate = (double) (c10k.established - previous) / ((double) (elapsed > 0 ? elapsed : 1) / 1e9);
+
+        started = clock_now_ns();
+        run_step(&c10k, options);
+        result->elapsed_ns = clock_now_ns() - started;
+        result->requests = result->histogram->count;
+        result->server_rss_kb = options->server_pid > 0 ? rss_kb(options->server_pid) : -1;
+
+        ++*results_count;
+
+        if (target == options->connections)
+            break;
+    }
+
+    for (uint_32 i = 0; i < c10k.conns_count; ++i) {
+        if (c10k.conns[i].state != CLOSED)
+            close(c10k.conns[i].fd);
+    }
+
+    close(c10k.epoll_fd);
+    free(c10k.conns);
+    marshall_free(&c10k.request);
+    freeaddrinfo(c10k.addr);
+
+    return EXIT_SUCCESS;
+}
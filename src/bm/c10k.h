@@ -0,0 +1,21 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_BM_C10K_H
+#define CSOCKET_BM_C10K_H
+
+#include "types/primitive.h"
+#include "np/types.h"
+#include "report.h"
+
+struct c10k_options {
+    uint_32 connections;
+    uint_32 step;
+    double rate;
+    uint_32 duration;
+    int_32 server_pid;
+};
+
+bool c10k_parse(const char *spec, struct c10k_options *);
+
+uint_8 c10k_run(const struct host_addr *, const struct c10k_options *, struct bm_result *results, uint_8 *results_count);
+
+#endif /* CSOCKET_BM_C10K_H */
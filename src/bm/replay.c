@@ -0,0 +1,103 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "replay.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "log.h"
+#include "rh/client.h"
+#include "stats/capture.h"
+#include "stats/clock.h"
+
+/* PATH[:speed=N], speed 0 sends the frames back to back */
+bool replay_parse(const char *const spec, struct replay_options *const options) {
+    static char buffer[4096];
+    char *option, *endptr;
+
+    if (strlen(spec) >= sizeof(buffer))
+        return false;
+
+    strcpy(buffer, spec);
+    options->path = buffer;
+    options->speed = 1;
+
+    if (NULL != (option = strrchr(buffer, ':')) && strncmp(option + 1, "speed=", 6) == 0) {
+        *option = '\0';
+        options->speed = strtod(option + 7, &endptr);
+
+        if (*endptr != '\0' || endptr == option + 7 || options->speed < 0)
+            return false;
+    }
+
+    return *options->path != '\0';
+}
+
+static void sleep_until(const uint_64 deadline_ns) {
+    const uint_64 now = clock_now_ns();
+    struct timespec delay;
+
+    if (deadline_ns > now) {
+        delay.tv_sec = (time_t) ((deadline_ns - now) / 1000000000U);
+        delay.tv_nsec = (long) ((deadline_ns - now) % 1000000000U);
+        nanosleep(&delay, NULL);
+    }
+}
+
+/* Frames are sent one at a time on a single connection; when paced, latency is measured from the moment the capture
+ * says the frame should have been sent, so a server that falls behind is charged for the queueing it causes */
+uint_8 replay_run(const struct host_addr *const host_addr, const struct replay_options *const options,
+                  struct bm_result *const result) {
+    struct capture_frame frame;
+    rh_server_msg *reply;
+    rh_conn_ctx *conn = NULL;
+    capture *capture;
+    uint_64 started, scheduled_at, elapsed;
+
+    if (NULL == (capture = capture_map(options->path))) {
+        log_error(ERROR, errno, "%s: failed to open capture", options->path);
+        return EXIT_FAILURE;
+    }
+
+    log_print(INFO, "Replaying %s at %s", options->path, options->speed > 0 ? "capture pace" : "full speed");
+
+    started = clock_now_ns();
+
+    while (capture_next(capture, &frame)) {
+        scheduled_at = options->speed > 0 ? started + (uint_64) ((double) frame.offset_ns / options->speed) : clock_now_ns();
+
+        sleep_until(scheduled_at);
+
+        if (conn == NULL && NULL == (conn = rh_client_new(host_addr->protocol, host_addr->address, host_addr->port))) {
+            ++result->errors;
+            log_error(DEBUG, errno, "replay: failed to connect");
+            continue;
+        }
+
+        if (rh_send_to_server(conn, frame.data, frame.size) && NULL != (reply = rh_receive_from_server(conn))) {
+            histogram_record(result->histogram, elapsed = clock_now_ns() - scheduled_at);
+            log_print(NOISY, "replay: %u bytes in %.3f µs", frame.size, (double) elapsed / 1000.0);
+            rh_server_msg_destroy(reply);
+        } else {
+            ++result->errors;
+            log_error(DEBUG, errno, "replay: frame of %u bytes failed", frame.size);
+
+            /* a late reply would be taken for the next frame's */
+            rh_client_destroy(conn);
+            conn = NULL;
+        }
+    }
+
+    result->elapsed_ns = clock_now_ns() - started;
+    result->requests = result->histogram->count;
+
+    if (conn != NULL)
+        rh_client_destroy(conn);
+
+    capture_unmap(capture);
+
+    return EXIT_SUCCESS;
+}
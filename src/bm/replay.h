@@ -0,0 +1,18 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_BM_REPLAY_H
+#define CSOCKET_BM_REPLAY_H
+
+#include "types/primitive.h"
+#include "np/types.h"
+#include "report.h"
+
+struct replay_options {
+    const char *path;
+    double speed;
+};
+
+bool replay_parse(const char *spec, struct replay_options *);
+
+uint_8 replay_run(const struct host_addr *, const struct replay_options *, struct bm_result *result);
+
+#endif /* CSOCKET_BM_REPLAY_H */
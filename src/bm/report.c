@@ -0,0 +1,277 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "report.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+
+static const struct {
+    const char *key;
+    double percentile;
+} percentiles[] = {
+        {"p50_ns",    50},
+        {"p90_ns",    90},
+        {"p99_ns",    99},
+        {"p99.9_ns",  99.9},
+        {"p99.99_ns", 99.99}
+};
+
+#define PERCENTILES_COUNT (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/* Escapes `src` into a JSON string body, truncated to fit `size` */
+static const char *json_escape(const char *src, char *const dst, const usize size) {
+    usize length = 0;
+
+    for (; *src != '\0'; ++src) {
+        const unsigned char c = (unsigned char) *src;
+
+        if (c == '"' || c == '\\') {
+            if (length + 2 >= size)
+                break;
+
+            dst[length++] = '\\';
+            dst[length++] = (char) c;
+        } else if (c < 0x20) {
+            if (length + 6 >= size)
+                break;
+
+            length += (usize) snprintf(dst + length, size - length, "\\u%04x", c);
+        } else if (length + 1 < size)
+            dst[length++] = (char) c;
+        else
+            break;
+    }
+
+    dst[length] = '\0';
+
+    return dst;
+}
+
+static __inline double throughput(const struct bm_result *const result) {
+    return result->elapsed_ns > 0 ? (double) result->requests / ((double) result->elapsed_ns / 1e9) : 0;
+}
+
+bool bm_format_parse(const char *const format_name, enum bm_format *const format) {
+    if (strcmp(format_name, "text") == 0)
+        *format = TEXT;
+    else if (strcmp(format_name, "json") == 0)
+        *format = JSON;
+    else if (strcmp(format_name, "csv") == 0)
+        *format = CSV;
+    else
+        return false;
+
+    return true;
+}
+
+static void write_text(FILE *const out, const struct bm_result *const result) {
+    const struct histogram *const h = result->histogram;
+
+    fprintf(out, "--- %s ---\n", result->name);
+    fprintf(out, "%lu requests, %lu errors in %.3f s, %.1f req/s\n", (unsigned long) result->requests,
+            (unsigned long) result->errors, (double) result->elapsed_ns / 1e9, throughput(result));
+
+    if (result->connections > 0)
+        fprintf(out, "%u connections, %.1f conn/s, server rss %ld kB\n", result->connections, result->accept_rate,
+                (long) result->server_rss_kb);
+
+    if (h->count == 0)
+        return;
+
+    fprintf(out, "min/avg/max = %.3f/%.3f/%.3f µs\n", (double) h->min / 1000.0, histogram_mean(h) / 1000.0,
+            (double) h->max / 1000.0);
+    fprintf(out, "p50/p90/p99/p99.9/p99.99 =");
+
+    for (uint_8 i = 0; i < PERCENTILES_COUNT; ++i)
+        fprintf(out, "%c%.3f", i == 0 ? ' ' : '/', (double) histogram_percentile(h, percentiles[i].percentile) / 1000.0);
+
+    fprintf(out, " µs\n");
+}
+
+static void write_json(FILE *const out, const struct bm_result *const result) {
+    const struct histogram *const h = result->histogram;
+    char name[512];
+    bool first = true;
+
+    fprintf(out, "    {\"scenario\": \"%s\", \"requests\": %lu, \"errors\": %lu, \"elapsed_ns\": %lu, \"throughput\": %.3f",
+            json_escape(result->name, name, sizeof(name)), (unsigned long) result->requests, (unsigned long) result->errors,
+            (unsigned long) result->elapsed_ns, throughput(result));
+    fprintf(out, ", \"min_ns\": %lu, \"mean_ns\": %.3f, \"max_ns\": %lu", (unsigned long) (h->count ? h->min : 0),
+            histogram_mean(h), (unsigned long) h->max);
+
+    for (uint_8 i = 0; i < PERCENTILES_COUNT; ++i)
+        fprintf(out, ", \"%s\": %lu", percentiles[i].key, (unsigned long) histogram_percentile(h, percentiles[i].percentile));
+
+    if (result->connections > 0)
+        fprintf(out, ", \"connections\": %u, \"accept_rate\": %.3f, \"server_rss_kb\": %ld", result->connections,
+                result->accept_rate, (long) result->server_rss_kb);
+
+    fprintf(out, ",\n     \"buckets\": [");
+
+    for (uint_32 i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (h->counts[i] > 0) {
+            fprintf(out, "%s[%lu, %lu, %lu]", first ? "" : ", ", (unsigned long) histogram_bucket_lower(i),
+                    (unsigned long) histogram_bucket_upper(i), (unsigned long) h->counts[i]);
+            first = false;
+        }
+    }
+
+    fprintf(out, "]}");
+}
+
+static void write_csv(FILE *const out, const struct bm_result *const result) {
+    const struct histogram *const h = result->histogram;
+
+    fprintf(out, "%s,requests,%lu\n", result->name, (unsigned long) result->requests);
+    fprintf(out, "%s,errors,%lu\n", result->name, (unsigned long) result->errors);
+    fprintf(out, "%s,elapsed_ns,%lu\n", result->name, (unsigned long) result->elapsed_ns);
+    fprintf(out, "%s,throughput,%.3f\n", result->name, throughput(result));
+    fprintf(out, "%s,min_ns,%lu\n", result->name, (unsigned long) (h->count ? h->min : 0));
+    fprintf(out, "%s,mean_ns,%.3f\n", result->name, histogram_mean(h));
+    fprintf(out, "%s,max_ns,%lu\n", result->name, (unsigned long) h->max);
+
+    for (uint_8 i = 0; i < PERCENTILES_COUNT; ++i)
+        fprintf(out, "%s,%s,%lu\n", result->name, percentiles[i].key, (unsigned long) histogram_percentile(h, percentiles[i].percentile));
+
+    if (result->connections > 0) {
+        fprintf(out, "%s,connections,%u\n", result->name, result->connections);
+        fprintf(out, "%s,accept_rate,%.3f\n", result->name, result->accept_rate);
+        fprintf(out, "%s,server_rss_kb,%ld\n", result->name, (long) result->server_rss_kb);
+    }
+
+    for (uint_32 i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (h->counts[i] > 0)
+            fprintf(out, "%s,bucket_%lu_%lu,%lu\n", result->name, (unsigned long) histogram_bucket_lower(i),
+                    (unsigned long) histogram_bucket_upper(i), (unsigned long) h->counts[i]);
+    }
+}
+
+void bm_report_write(FILE *const out, const enum bm_format format, const char *const target,
+                     const struct bm_result *const results, const uint_8 results_count) {
+    char hostname[256] = {0}, escaped_hostname[512], escaped_target[512];
+
+    gethostname(hostname, sizeof(hostname) - 1);
+
+    switch (format) {
+        case JSON:
+            fprintf(out, "{\n  \"metadata\": {\"tool\": \"csocket\", \"hostname\": \"%s\", \"target\": \"%s\", \"timestamp\": %ld},\n",
+                    json_escape(hostname, escaped_hostname, sizeof(escaped_hostname)),
+                    json_escape(target, escaped_target, sizeof(escaped_target)), (long) time(NULL));
+            fprintf(out, "  \"results\": [\n");
+
+            for (uint_8 i = 0; i < results_count; ++i) {
+                write_json(out, &results[i]);
+                fprintf(out, i + 1 < results_count ? ",\n" : "\n");
+            }
+
+            fprintf(out, "  ]\n}\n");
+            break;
+        case CSV:
+            fprintf(out, "scenario,metric,value\n");
+            fprintf(out, "metadata,hostname,%s\n", hostname);
+            fprintf(out, "metadata,target,%s\n", target);
+            fprintf(out, "metadata,timestamp,%ld\n", (long) time(NULL));
+
+            for (uint_8 i = 0; i < results_count; ++i)
+                write_csv(out, &results[i]);
+            break;
+        default:
+            for (uint_8 i = 0; i < results_count; ++i)
+                write_text(out, &results[i]);
+    }
+}
+
+/* Finds `key` inside the section that belongs to `scenario`, in either the JSON or the CSV layout written above. */
+static bool baseline_value(const char *const text, const char *const scenario, const char *const key, double *const value) {
+    char needle[640], name[512];
+    const char *section, *end, *pos;
+
+    snprintf(needle, sizeof(needle), "\"scenario\": \"%s\"", json_escape(scenario, name, sizeof(name)));
+
+    if (NULL != (section = strstr(text, needle))) {
+        end = strstr(section + 1, "\"scenario\": ");
+        snprintf(needle, sizeof(needle), "\"%s\": ", key);
+    } else {
+        snprintf(needle, sizeof(needle), "\n%s,%s,", scenario, key);
+        section = text;
+        end = NULL;
+    }
+
+    if (NULL == (pos = strstr(section, needle)) || (end != NULL && pos > end))
+        return false;
+
+    *value = strtod(pos + strlen(needle), NULL);
+
+    return true;
+}
+
+static char *read_file(const char *const path) {
+    FILE *file;
+    char *text;
+    long size;
+
+    if (NULL == (file = fopen(path, "r")))
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    text = malloc((usize) size + 1);
+    text[fread(text, 1, (usize) size, file)] = '\0';
+
+    fclose(file);
+
+    return text;
+}
+
+uint_8 bm_compare_baseline(const char *const baseline_path, const double threshold, const struct bm_result *const results,
+                           const uint_8 results_count) {
+    uint_8 status = EXIT_SUCCESS;
+    double base_p99, base_throughput, p99, tput;
+    char *text;
+
+    if (NULL == (text = read_file(baseline_path))) {
+        log_error(ERROR, errno, "%s: failed to read baseline", baseline_path);
+        return EXIT_FAILURE;
+    }
+
+    for (uint_8 i = 0; i < results_count; ++i) {
+        if (!baseline_value(text, results[i].name, "p99_ns", &base_p99) ||
+            !baseline_value(text, results[i].name, "throughput", &base_throughput)) {
+            /* a scenario with nothing to compare to could regress unnoticed forever, the baseline has to be refreshed */
+            log_print(ERROR, "%s: scenario '%s' not found in baseline", baseline_path, results[i].name);
+
+            if (status == EXIT_SUCCESS)
+                status = EXIT_FAILURE;
+
+            continue;
+        }
+
+        p99 = (double) histogram_percentile(results[i].histogram, 99);
+        tput = throughput(&results[i]);
+
+        log_print(INFO, "%s: p99 %.3f µs (baseline %.3f µs, %+.1f%%), throughput %.1f req/s (baseline %.1f req/s, %+.1f%%)",
+                  results[i].name, p99 / 1000.0, base_p99 / 1000.0, base_p99 > 0 ? (p99 / base_p99 - 1) * 100 : 0,
+                  tput, base_throughput, base_throughput > 0 ? (tput / base_throughput - 1) * 100 : 0);
+
+        if (p99 > base_p99 * (1 + threshold / 100)) {
+            log_print(ERROR, "%s: p99 regressed by more than %.1f%%", results[i].name, threshold);
+            status = EXIT_REGRESSION;
+        }
+
+        if (tput < base_throughput * (1 - threshold / 100)) {
+            log_print(ERROR, "%s: throughput regressed by more than %.1f%%", results[i].name, threshold);
+            status = EXIT_REGRESSION;
+        }
+    }
+
+    free(text);
+
+    return status;
+}
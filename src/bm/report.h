@@ -0,0 +1,32 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_BM_REPORT_H
+#define CSOCKET_BM_REPORT_H
+
+#include <stdio.h>
+#include "types/primitive.h"
+#include "stats/histogram.h"
+
+enum bm_format {
+    TEXT,
+    JSON,
+    CSV
+};
+
+struct bm_result {
+    const char *name;
+    uint_64 requests;
+    uint_64 errors;
+    uint_64 elapsed_ns;
+    struct histogram *histogram;
+    uint_32 connections;
+    double accept_rate;
+    ssize server_rss_kb;
+};
+
+bool bm_format_parse(const char *format_name, enum bm_format *);
+
+void bm_report_write(FILE *, enum bm_format, const char *target, const struct bm_result *results, uint_8 results_count);
+
+uint_8 bm_compare_baseline(const char *baseline_path, double threshold, const struct bm_result *results, uint_8 results_count);
+
+#endif /* CSOCKET_BM_REPORT_H */
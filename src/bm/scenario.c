@@ -0,0 +1,164 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "scenario.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+static const char *const method_names[SCENARIO_METHODS] = {"add", "sub", "mul", "div"};
+
+static const struct {
+    const char *name;
+    uint_32 weights[SCENARIO_METHODS];
+    uint_16 payloads[SCENARIO_PAYLOADS_MAX];
+    uint_8 payloads_count;
+    bool keep_alive;
+} presets[] = {
+        {"default", {1,  0,  0,  0},  {0},                   1, true},
+        {"mix",     {25, 25, 25, 25}, {0},                   1, true},
+        {"churn",   {1,  0,  0,  0},  {0},                   1, false},
+        {"sweep",   {1,  0,  0,  0},  {0, 32, 128, 256, 480}, 5, true}
+};
+
+void scenario_default(struct scenario *const scenario) {
+    memset(scenario, 0, sizeof(struct scenario));
+    strcpy(scenario->name, "default");
+    scenario->weights[ADD] = 1;
+    scenario->payloads_count = 1;
+    scenario->keep_alive = true;
+}
+
+static bool parse_number(const char *const str, const long max, long *const number) {
+    char *endptr;
+
+    *number = strtol(str, &endptr, 10);
+
+    return *endptr == '\0' && endptr != str && *number >= 0 && *number <= max;
+}
+
+static bool parse_option(struct scenario *const scenario, const char *const key, char *const value) {
+    long number;
+
+    for (uint_8 i = 0; i < SCENARIO_METHODS; ++i) {
+        if (strcmp(key, method_names[i]) == 0) {
+            if (!parse_number(value, INT_MAX, &number))
+                return false;
+
+            scenario->weights[i] = (uint_32) number;
+            return true;
+        }
+    }
+
+    if (strcmp(key, "payload") == 0) {
+        scenario->payloads_count = 0;
+
+        for (char *size = strtok(value, "/"); size != NULL; size = strtok(NULL, "/")) {
+            if (scenario->payloads_count == SCENARIO_PAYLOADS_MAX || !parse_number(size, SCENARIO_PAYLOAD_MAX, &number))
+                return false;
+
+            scenario->payloads[scenario->payloads_count++] = (uint_16) number;
+        }
+
+        return scenario->payloads_count > 0;
+    } else if (strcmp(key, "connect") == 0) {
+        if (strcmp(value, "keepalive") == 0)
+            scenario->keep_alive = true;
+        else if (strcmp(value, "request") == 0)
+            scenario->keep_alive = false;
+        else
+            return false;
+
+        return true;
+    } else if (strcmp(key, "think") == 0) {
+        if (!parse_number(value, INT_MAX, &number))
+            return false;
+
+        scenario->think_us = (uint_32) number;
+        return true;
+    } else if (strcmp(key, "deadline") == 0) {
+        if (!parse_number(value, INT_MAX, &number))
+            return false;
+
+        scenario->deadline_us = (uint_32) number;
+        return true;
+    } else if (strcmp(key, "requests") == 0) {
+        if (!parse_number(value, INT_MAX, &number) || number == 0)
+            return false;
+
+        scenario->requests = (uint_32) number;
+        return true;
+    }
+
+    return false;
+}
+
+/* NAME[:KEY=VALUE[,KEY=VALUE...]] where NAME may be one of the presets and KEY is add, sub, mul, div (weights),
+ * payload (padding bytes, '/' separated to sweep), connect (keepalive or request), think (µs), deadline (µs the server
+ * has to answer, 0 for the requestor default) or requests */
+bool scenario_parse(const char *const spec, struct scenario *const scenario) {
+    char buffer[256], *name, *options, *saveptr = NULL;
+    uint_32 total = 0;
+
+    if (strlen(spec) >= sizeof(buffer))
+        return false;
+
+    strcpy(buffer, spec);
+    name = buffer;
+
+    if (NULL != (options = strchr(buffer, ':')))
+        *options++ = '\0';
+
+    if (*name == '\0' || strlen(name) >= sizeof(scenario->name))
+        return false;
+
+    scenario_default(scenario);
+    strcpy(scenario->name, name);
+
+    for (uint_8 i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i) {
+        if (strcmp(name, presets[i].name) == 0) {
+            memcpy(scenario->weights, presets[i].weights, sizeof(scenario->weights));
+            memcpy(scenario->payloads, presets[i].payloads, sizeof(scenario->payloads));
+            scenario->payloads_count = presets[i].payloads_count;
+            scenario->keep_alive = presets[i].keep_alive;
+        }
+    }
+
+    if (options != NULL) {
+        for (char *option = strtok_r(options, ",", &saveptr); option != NULL; option = strtok_r(NULL, ",", &saveptr)) {
+            char *value = strchr(option, '=');
+
+            if (value == NULL)
+                return false;
+
+            *value++ = '\0';
+
+            if (!parse_option(scenario, option, value))
+                return false;
+        }
+    }
+
+    for (uint_8 i = 0; i < SCENARIO_METHODS; ++i)
+        total += scenario->weights[i];
+
+    return total > 0;
+}
+
+enum scenario_method scenario_pick_method(const struct scenario *const scenario) {
+    uint_32 total = 0, pick;
+
+    for (uint_8 i = 0; i < SCENARIO_METHODS; ++i)
+        total += scenario->weights[i];
+
+    pick = (uint_32) rand() % total;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
+
+    for (uint_8 i = 0; i < SCENARIO_METHODS; ++i) {
+        if (pick < scenario->weights[i])
+            return (enum scenario_method) i;
+
+        pick -= scenario->weights[i];
+    }
+
+    return ADD;
+}
@@ -0,0 +1,36 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_BM_SCENARIO_H
+#define CSOCKET_BM_SCENARIO_H
+
+#include "types/primitive.h"
+
+#define SCENARIO_PAYLOADS_MAX 8
+#define SCENARIO_PAYLOAD_MAX 480
+
+enum scenario_method {
+    ADD,
+    SUB,
+    MUL,
+    DIV
+};
+
+#define SCENARIO_METHODS 4
+
+struct scenario {
+    char name[32];
+    uint_32 weights[SCENARIO_METHODS];
+    uint_16 payloads[SCENARIO_PAYLOADS_MAX];
+    uint_8 payloads_count;
+    bool keep_alive;
+    uint_32 think_us;
+    uint_32 deadline_us;
+    uint_32 requests;
+};
+
+bool scenario_parse(const char *spec, struct scenario *);
+
+void scenario_default(struct scenario *);
+
+enum scenario_method scenario_pick_method(const struct scenario *);
+
+#endif /* CSOCKET_BM_SCENARIO_H */
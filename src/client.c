@@ -1,15 +1,21 @@
 /* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 199309L
+
 #include "client.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <math.h>
 #include "log.h"
 #include "cp/calc.h"
+#include "np/naming_proxy.h"
+#include "stats/clock.h"
+#include "stats/histogram.h"
 
-static void send_request(uint_16 a, uint_16 b) {
+static bool send_request(uint_16 a, uint_16 b) {
     int_32 result = 0;
 
     if (calc.add(a, b, &result)) {
@@ -17,8 +23,11 @@ static void send_request(uint_16 a, uint_16 b) {
             die(EXIT_FAILURE, NOERR, "%u + %u != %d", a, b, result);
         else
             log_print(NOISY, "%u + %u = %d", a, b, result);
-    } else
-        die(EXIT_FAILURE, errno, "Calc failed");
+
+        return true;
+    }
+
+    return false;
 }
 
 void run_client(void) {
@@ -28,45 +37,155 @@ void run_client(void) {
         a = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
         b = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
 
-        send_request(a, b);
+        if (!send_request(a, b))
+            die(EXIT_FAILURE, errno, "Calc failed");
     }
 }
 
-uint_8 run_client_benchmark(uint_16 benchmark_num) {
-    uint_16 i, a, b;
-    double total_time = 0, *times = malloc(sizeof(double) * benchmark_num), min, avg, max = 0, mdev = 0;
-    double n = ceil(log10(benchmark_num + 1));
-    clock_t begin;
+static void target_name(char *const target, const usize size) {
+    static const char *const schemes[] = {"tcp", "udp", "unix", "unixpacket", "shm"};
+    const struct host_addr *host_addr;
+
+    if (np_lookup("calc", &host_addr) && RH_LOCAL(host_addr->protocol))
+        snprintf(target, size, "%s://%s", schemes[host_addr->protocol], host_addr->address);
+    else if (host_addr != NULL)
+        snprintf(target, size, "%s://%s:%u", schemes[host_addr->protocol], host_addr->address, host_addr->port);
+    else
+        snprintf(target, size, "unknown");
+}
+
+static bool send_scenario_request(const enum scenario_method method) {
+    uint_16 a = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
+    uint_16 b = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
+    int_32 result = 0, expected;
+    bool ok;
+
+    switch (method) {
+        case SUB:
+            ok = calc.sub(a, b, &result);
+            expected = a - b;
+            break;
+        case MUL:
+            a &= INT16_MAX;
+            b &= INT16_MAX;
+            ok = calc.mul(a, b, &result);
+            expected = a * b;
+            break;
+        case DIV:
+            ok = calc.div(a, b, &result);
+            expected = a / b;
+            break;
+        default:
+            return send_request(a, b);
+    }
+
+    if (ok && result != expected)
+        die(EXIT_FAILURE, NOERR, "%u %c %u != %d", a, "+-*/"[method], b, result);
 
-    for (i = 0; i < 10; ++i)
+    return ok;
+}
+
+static void run_scenario(const struct scenario *const scenario, const uint_16 payload, struct bm_result *const result) {
+    const struct timespec think = {.tv_sec = scenario->think_us / 1000000, .tv_nsec = (long) (scenario->think_us % 1000000) * 1000};
+    int_32 n = (int_32) ceil(log10(scenario->requests + 1.0));
+    uint_64 begin, elapsed, started;
+
+    calc_configure(payload, scenario->keep_alive, scenario->deadline_us);
+
+    for (uint_32 i = 0; i < 10; ++i)
         send_request(20, 30);
 
-    for (i = 0; i < benchmark_num; ++i) {
-        a = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
-        b = (rand() % UINT16_MAX) + 1;  /* NOLINT(cert-msc30-c,cert-msc50-cpp) */
+    started = clock_now_ns();
+
+    for (uint_32 i = 0; i < scenario->requests; ++i) {
+        begin = clock_now_ns();
+
+        if (send_scenario_request(scenario_pick_method(scenario))) {
+            histogram_record(result->histogram, elapsed = clock_now_ns() - begin);
+            log_print(NOISY, "%s %.*u: %.3f µs", result->name, n, i + 1, (double) elapsed / 1000.0);
+        } else {
+            ++result->errors;
+            log_error(DEBUG, errno, "%s %.*u: calc failed", result->name, n, i + 1);
+        }
 
-        begin = clock();
-        send_request(a, b);
-        total_time += (times[i] = (double) (clock() - begin) / (CLOCKS_PER_SEC / 1000000.0));
+        if (scenario->think_us > 0)
+            nanosleep(&think, NULL);
+    }
+
+    result->elapsed_ns = clock_now_ns() - started;
+    result->requests = result->histogram->count;
+}
+
+uint_8 run_client_benchmark(const struct benchmark_options *const options) {
+    struct bm_result results[UINT8_MAX];
+    struct scenario default_scenario, scenario;
+    uint_8 results_count = 0, status = EXIT_SUCCESS;
+    char target[300], name[64];
+    FILE *out = stdout;
+
+    if (options->output != NULL && NULL == (out = fopen(options->output, "w")))
+        die(EXIT_FAILURE, errno, "%s: failed to open output", options->output);
+
+    scenario_default(&default_scenario);
+
+    if (options->c10k.connections > 0) {
+        const struct host_addr *host_addr;
+
+        memset(results, 0, sizeof(results));
+
+        if (!np_lookup("calc", &host_addr))
+            die(EXIT_MISTAKE, NOERR, "calc: service address not set");
 
-        log_print(NOISY, "%.*d: %.0f µs", (int_32) n, i + 1, times[i]);
+        if (EXIT_SUCCESS != (status = c10k_run(host_addr, &options->c10k, results, &results_count)))
+            return status;
+    } else if (options->replay.path != NULL) {
+        const struct host_addr *host_addr;
+
+        memset(results, 0, sizeof(struct bm_result));
+        results[0].name = strcpy(malloc(sizeof("replay")), "replay");
+        results[0].histogram = histogram_new();
+
+        if (!np_lookup("calc", &host_addr))
+            die(EXIT_MISTAKE, NOERR, "calc: service address not set");
+
+        if (EXIT_SUCCESS != (status = replay_run(host_addr, &options->replay, &results[results_count++])))
+            return status;
     }
 
-    avg = total_time / benchmark_num;
-    min = times[0];
+    for (uint_8 i = 0; options->c10k.connections == 0 && options->replay.path == NULL && i < (options->scenarios_count > 0 ? options->scenarios_count : 1); ++i) {
+        scenario = options->scenarios_count > 0 ? options->scenarios[i] : default_scenario;
+
+        if (scenario.requests == 0)
+            scenario.requests = options->requests;
 
-    for (i = 0; i < benchmark_num; ++i) {
-        max = max > times[i] ? max : times[i];
-        min = min < times[i] ? min : times[i];
-        mdev += pow(times[i] - avg, 2);
+        for (uint_8 j = 0; j < scenario.payloads_count && results_count < UINT8_MAX; ++j) {
+            if (scenario.payloads_count > 1)
+                snprintf(name, sizeof(name), "%s/%uB", scenario.name, scenario.payloads[j]);
+            else
+                snprintf(name, sizeof(name), "%s", scenario.name);
+
+            memset(&results[results_count], 0, sizeof(struct bm_result));
+            results[results_count].name = strcpy(malloc(strlen(name) + 1), name);
+            results[results_count].histogram = histogram_new();
+
+            log_print(INFO, "Running scenario %s", name);
+            run_scenario(&scenario, scenario.payloads[j], &results[results_count++]);
+        }
     }
 
-    mdev = sqrt(mdev / benchmark_num);
+    target_name(target, sizeof(target));
+    bm_report_write(out, options->format, target, results, results_count);
 
-    for (i = 0; i < benchmark_num; ++i)
-        printf("%.0f\n", times[i]);
+    if (out != stdout)
+        fclose(out);
 
-    printf("min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f µs\n", min, avg, max, mdev);
+    if (options->baseline != NULL)
+        status = bm_compare_baseline(options->baseline, options->threshold, results, results_count);
+
+    for (uint_8 i = 0; i < results_count; ++i) {
+        free((char *) results[i].name);
+        histogram_destroy(results[i].histogram);
+    }
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -3,9 +3,25 @@
 #define CSOCKET_CLIENT_H
 
 #include "types/primitive.h"
+#include "bm/report.h"
+#include "bm/scenario.h"
+#include "bm/c10k.h"
+#include "bm/replay.h"
+
+struct benchmark_options {
+    uint_32 requests;
+    enum bm_format format;
+    const char *output;
+    const char *baseline;
+    double threshold;
+    struct scenario *scenarios;
+    uint_8 scenarios_count;
+    struct c10k_options c10k;
+    struct replay_options replay;
+};
 
 __attribute__((noreturn)) void run_client(void);
 
-uint_8 run_client_benchmark(uint_16 benchmark_num);
+uint_8 run_client_benchmark(const struct benchmark_options *);
 
 #endif /* CSOCKET_CLIENT_H */
@@ -0,0 +1,305 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE  /* MAP_ANONYMOUS */
+
+#include "coroutine.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "log.h"
+#include "stats/clock.h"
+
+#define STACK_SIZE (64 * 1024)
+#define STACKS_CACHED 64
+
+struct coroutine {
+    struct scheduler *scheduler;
+    ucontext_t context;
+    byte *stack;
+    coroutine_func *func;
+    void *arg;
+    int fd;
+    short events;
+    short revents;
+    uint_64 deadline;
+    bool parked;
+    bool done;
+    struct coroutine *next;
+};
+
+struct queue {
+    struct coroutine *head;
+    struct coroutine *tail;
+};
+
+/* Other threads hand the scheduler new coroutines and wake parked ones through the inbox, and the eventfd wakes it up */
+struct scheduler {
+    pthread_mutex_t inbox_mutex;
+    struct queue inbox;
+    struct queue woken;
+    int wakeup;
+    ucontext_t context;
+    struct coroutine *current;
+    struct queue ready;
+    struct coroutine *waiting;
+    usize waiting_count;
+    byte *stacks[STACKS_CACHED];
+    uint_8 stacks_count;
+};
+
+static __thread struct scheduler *local = NULL;
+
+static void queue_push(struct queue *const queue, struct coroutine *const co) {
+    co->next = NULL;
+
+    if (queue->tail != NULL)
+        queue->tail->next = co;
+    else
+        queue->head = co;
+
+    queue->tail = co;
+}
+
+static struct coroutine *queue_pop(struct queue *const queue) {
+    struct coroutine *co = queue->head;
+
+    if (co != NULL && NULL == (queue->head = co->next))
+        queue->tail = NULL;
+
+    return co;
+}
+
+struct scheduler *scheduler_new(void) {
+    struct scheduler *scheduler = calloc(1, sizeof(struct scheduler));
+
+    pthread_mutex_init(&scheduler->inbox_mutex, NULL);
+
+    if ((scheduler->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        die(EXIT_FAILURE, errno, "Failed to create scheduler");
+
+    return scheduler;
+}
+
+/* Only the first coroutine of a batch wakes the scheduler up, it takes the whole inbox at once */
+static void deliver(struct scheduler *const scheduler, struct queue *const queue, struct coroutine *const co) {
+    const uint_64 one = 1;
+    bool idle;
+
+    pthread_mutex_lock(&scheduler->inbox_mutex);
+    idle = scheduler->inbox.head == NULL && scheduler->woken.head == NULL;
+    queue_push(queue, co);
+    pthread_mutex_unlock(&scheduler->inbox_mutex);
+
+    if (idle && write(scheduler->wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_error(ERROR, errno, "Failed to wake scheduler up");
+}
+
+void scheduler_submit(struct scheduler *const scheduler, coroutine_func *const func, void *const arg) {
+    struct coroutine *co = malloc(sizeof(struct coroutine));
+
+    co->func = func;
+    co->arg = arg;
+
+    deliver(scheduler, &scheduler->inbox, co);
+}
+
+/* Stacks are mapped with a guard page below them, so an overflow faults instead of corrupting the heap */
+static byte *stack_new(struct scheduler *const scheduler) {
+    const long page = sysconf(_SC_PAGESIZE);
+    byte *stack;
+
+    if (scheduler->stacks_count > 0)
+        return scheduler->stacks[--scheduler->stacks_count];
+
+    if (MAP_FAILED == (stack = mmap(NULL, STACK_SIZE + (usize) page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)))
+        die(EXIT_FAILURE, errno, "Failed to map coroutine stack");
+
+    mprotect(stack, (usize) page, PROT_NONE);
+
+    return stack + page;
+}
+
+static void stack_free(struct scheduler *const scheduler, byte *const stack) {
+    const long page = sysconf(_SC_PAGESIZE);
+
+    if (scheduler->stacks_count < STACKS_CACHED)
+        scheduler->stacks[scheduler->stacks_count++] = stack;
+    else
+        munmap(stack - page, STACK_SIZE + (usize) page);
+}
+
+static void trampoline(void) {
+    struct coroutine *co = local->current;
+
+    co->func(co->arg);
+    co->done = true;
+}
+
+static void start(struct scheduler *const scheduler, struct coroutine *const co) {
+    co->scheduler = scheduler;
+    co->stack = stack_new(scheduler);
+    co->fd = -1;
+    co->parked = co->done = false;
+
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp = co->stack;
+    co->context.uc_stack.ss_size = STACK_SIZE;
+    co->context.uc_link = &scheduler->context;
+    makecontext(&co->context, trampoline, 0);
+
+    queue_push(&scheduler->ready, co);
+}
+
+static void resume(struct scheduler *const scheduler, struct coroutine *const co) {
+    scheduler->current = co;
+    swapcontext(&scheduler->context, &co->context);
+    scheduler->current = NULL;
+
+    if (co->done) {
+        stack_free(scheduler, co->stack);
+        free(co);
+    } else if (co->parked) {
+        /* left out of every queue until coroutine_wake() hands it back */
+    } else if (co->fd >= 0) {
+        co->next = scheduler->waiting;
+        scheduler->waiting = co;
+        ++scheduler->waiting_count;
+    } else
+        queue_push(&scheduler->ready, co);
+}
+
+/* Blocks until a socket is ready, a wait times out or another thread delivers a coroutine, unless some are ready */
+static void poll_waiting(struct scheduler *const scheduler, struct pollfd *const fds) {
+    struct coroutine **link, *co;
+    int timeout = scheduler->ready.head != NULL ? 0 : -1;
+    usize n = 1;
+    uint_64 drain, now = clock_now_ns();
+
+    fds[0].fd = scheduler->wakeup;
+    fds[0].events = POLLIN;
+
+    for (co = scheduler->waiting; co != NULL; co = co->next, ++n) {
+        fds[n].fd = co->fd;
+        fds[n].events = co->events;
+
+        if (co->deadline > 0 && timeout != 0) {
+            const int until = co->deadline > now ? (int) ((co->deadline - now) / 1000000U) + 1 : 0;
+
+            timeout = timeout < 0 || until < timeout ? until : timeout;
+        }
+    }
+
+    if (poll(fds, n, timeout) < 0 && errno != EINTR)
+        die(EXIT_FAILURE, errno, "Scheduler error: poll()");
+
+    if (fds[0].revents & POLLIN && read(scheduler->wakeup, &drain, sizeof(drain)) < 0 && errno != EAGAIN)
+        log_error(ERROR, errno, "Failed to drain scheduler wakeup");
+
+    now = clock_now_ns();
+
+    for (link = &scheduler->waiting, n = 1; NULL != (co = *link); ++n) {
+        if (fds[n].revents != 0 || (co->deadline > 0 && co->deadline <= now)) {
+            co->revents = fds[n].revents;
+            co->fd = -1;
+            *link = co->next;
+            --scheduler->waiting_count;
+            queue_push(&scheduler->ready, co);
+        } else
+            link = &co->next;
+    }
+}
+
+void scheduler_run(struct scheduler *const scheduler) {
+    struct queue inbox, woken, ready;
+    struct pollfd *fds = NULL;
+    usize fds_capacity = 0;
+    struct coroutine *co;
+
+    local = scheduler;
+
+    for (;;) {
+        pthread_mutex_lock(&scheduler->inbox_mutex);
+        inbox = scheduler->inbox;
+        woken = scheduler->woken;
+        scheduler->inbox.head = scheduler->inbox.tail = NULL;
+        scheduler->woken.head = scheduler->woken.tail = NULL;
+        pthread_mutex_unlock(&scheduler->inbox_mutex);
+
+        while (NULL != (co = queue_pop(&inbox)))
+            start(scheduler, co);
+
+        while (NULL != (co = queue_pop(&woken))) {
+            co->parked = false;
+            queue_push(&scheduler->ready, co);
+        }
+
+        /* coroutines that yield again go to the next round */
+        ready = scheduler->ready;
+        scheduler->ready.head = scheduler->ready.tail = NULL;
+
+        while (NULL != (co = queue_pop(&ready)))
+            resume(scheduler, co);
+
+        if (fds_capacity < scheduler->waiting_count + 1) {
+            fds_capacity = (scheduler->waiting_count + 1) * 2;
+            fds = realloc(fds, sizeof(struct pollfd) * fds_capacity);
+        }
+
+        poll_waiting(scheduler, fds);
+    }
+}
+
+bool coroutine_active(void) {
+    return local != NULL && local->current != NULL;
+}
+
+/* Suspends the running coroutine until fd is ready or timeout_ms (-1 for none) elapses, and just polls when called
+ * outside of one; returns false with errno set to EAGAIN on timeout */
+bool coroutine_wait(const int fd, const short events, const int timeout_ms) {
+    struct pollfd pollfd = {.fd = fd, .events = events};
+    struct coroutine *co;
+    int ready;
+
+    if (!coroutine_active()) {
+        if ((ready = poll(&pollfd, 1, timeout_ms)) == 0)
+            errno = EAGAIN;
+
+        return ready > 0;
+    }
+
+    co = local->current;
+    co->fd = fd;
+    co->events = events;
+    co->revents = 0;
+    co->deadline = timeout_ms >= 0 ? clock_now_ns() + (uint_64) timeout_ms * 1000000U : 0;
+
+    swapcontext(&co->context, &local->context);
+
+    if (co->revents == 0)
+        errno = EAGAIN;
+
+    return co->revents != 0;
+}
+
+struct coroutine *coroutine_self(void) {
+    return coroutine_active() ? local->current : NULL;
+}
+
+void coroutine_suspend(void) {
+    struct coroutine *co = local->current;
+
+    co->parked = true;
+    swapcontext(&co->context, &local->context);
+}
+
+/* The scheduler only takes woken coroutines in between running them, so this may come before the coroutine is even
+ * done suspending */
+void coroutine_wake(struct coroutine *const co) {
+    deliver(co->scheduler, &co->scheduler->woken, co);
+}
@@ -0,0 +1,31 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_CO_COROUTINE_H
+#define CSOCKET_CO_COROUTINE_H
+
+#include "types/primitive.h"
+
+typedef void (coroutine_func)(void *);
+
+struct coroutine;
+
+struct scheduler;
+
+struct scheduler *scheduler_new(void);
+
+void scheduler_submit(struct scheduler *, coroutine_func *, void *arg);
+
+__attribute__((noreturn)) void scheduler_run(struct scheduler *);
+
+bool coroutine_active(void);
+
+bool coroutine_wait(int fd, short events, int timeout_ms);
+
+/* The running coroutine, NULL outside of one */
+struct coroutine *coroutine_self(void);
+
+/* Parks the running coroutine, without polling for it, until another one or any thread passes it to coroutine_wake() */
+void coroutine_suspend(void);
+
+void coroutine_wake(struct coroutine *);
+
+#endif /* CSOCKET_CO_COROUTINE_H */
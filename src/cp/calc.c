@@ -9,6 +9,27 @@ static const struct host_addr *host_addr = NULL;
 
 static struct requestor *requestor = NULL;
 
+static usize padding = 0;
+
+static bool keep_alive = true;
+
+static uint_32 deadline = 0;
+
+void calc_configure(const usize request_padding, const bool connection_keep_alive, const uint_32 deadline_us) {
+    padding = request_padding;
+    keep_alive = connection_keep_alive;
+    deadline = deadline_us;
+}
+
+static void push_padding(struct data *const request) {
+    static const byte zeros[UINT8_MAX] = {0};
+
+    for (usize left = padding, size; left > 0; left -= size) {
+        size = left > UINT8_MAX ? UINT8_MAX : left;
+        data_push(request, BYTES, (uint_8) size, zeros);
+    }
+}
+
 static bool calc_invoke(const char *method, const uint_16 a, const uint_16 b, int_32 *const result) {
     struct data *request, *reply = NULL;
     struct value reply_value;
@@ -18,13 +39,15 @@ static bool calc_invoke(const char *method, const uint_16 a, const uint_16 b, in
         requestor = NULL;
     }
 
-    if (requestor == NULL && (host_addr != NULL || np_lookup("calc", &host_addr)))
-        requestor = requestor_new(host_addr);
+    if (requestor == NULL && (host_addr != NULL || np_lookup("calc", &host_addr)) &&
+        NULL != (requestor = requestor_new(host_addr)) && deadline > 0)
+        requestor_set_deadline(requestor, deadline);
 
     if (requestor != NULL) {
         request = data_new(2);
         data_push(request, UINT, sizeof(uint_16), &a);
         data_push(request, UINT, sizeof(uint_16), &b);
+        push_padding(request);
 
         if (requestor_invoke(requestor, method, request, &reply)) {
             data_pop(reply, &reply_value);
@@ -35,6 +58,11 @@ static bool calc_invoke(const char *method, const uint_16 a, const uint_16 b, in
                 data_destroy(request);
                 data_destroy(reply);
 
+                if (!keep_alive) {
+                    requestor_destroy(requestor);
+                    requestor = NULL;
+                }
+
                 return true;
             } else
                 errno = ENOMSG;
@@ -43,6 +71,11 @@ static bool calc_invoke(const char *method, const uint_16 a, const uint_16 b, in
         }
 
         data_destroy(request);
+
+        if (!keep_alive) {
+            requestor_destroy(requestor);
+            requestor = NULL;
+        }
     } else
         errno = EHOSTUNREACH;
 
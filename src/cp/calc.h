@@ -9,6 +9,9 @@ bool calc_sub(uint_16 a, uint_16 b, int_32 *result);
 bool calc_mul(uint_16 a, uint_16 b, int_32 *result);
 bool calc_div(uint_16 a, uint_16 b, int_32 *result);
 
+/* A deadline of 0 leaves the requestor default */
+void calc_configure(usize request_padding, bool connection_keep_alive, uint_32 deadline_us);
+
 static struct {
     bool (*add)(uint_16, uint_16, int_32 *);
     bool (*sub)(uint_16, uint_16, int_32 *);
@@ -0,0 +1,100 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash.h"
+
+struct entry {
+    uint_64 hash;
+    byte *bytes;  /* the key followed by the reply */
+    usize key_size;
+    usize reply_size;
+};
+
+struct shard {
+    pthread_mutex_t mutex;
+    struct entry *entries;
+};
+
+struct cache {
+    uint_32 shard_entries;
+    struct shard shards[KEY_SHARDS];
+};
+
+struct cache *cache_new(const uint_32 entries) {
+    struct cache *cache = malloc(sizeof(struct cache));
+
+    cache->shard_entries = entries > KEY_SHARDS ? entries / KEY_SHARDS : 1;
+
+    for (uint_8 i = 0; i < KEY_SHARDS; ++i) {
+        pthread_mutex_init(&cache->shards[i].mutex, NULL);
+        cache->shards[i].entries = calloc(cache->shard_entries, sizeof(struct entry));
+    }
+
+    return cache;
+}
+
+/* Each key maps to a single slot of its shard, so a colliding key simply evicts the previous one: the cache stays
+ * bounded without any bookkeeping, and the pairs that keep repeating keep winning their slot back */
+static struct entry *entry_of(struct cache *const cache, const uint_64 hash, struct shard **const shard) {
+    *shard = &cache->shards[hash % KEY_SHARDS];
+
+    return &(*shard)->entries[(hash / KEY_SHARDS) % cache->shard_entries];
+}
+
+usize cache_get(struct cache *const cache, const byte *const key, const usize key_size, byte *const reply,
+                const usize reply_capacity) {
+    const uint_64 hash = hash_key(key, key_size);
+    struct shard *shard;
+    struct entry *entry = entry_of(cache, hash, &shard);
+    usize reply_size = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+
+    if (entry->bytes != NULL && entry->hash == hash && entry->key_size == key_size &&
+        entry->reply_size <= reply_capacity && memcmp(entry->bytes, key, key_size) == 0) {
+        memcpy(reply, entry->bytes + key_size, entry->reply_size);
+        reply_size = entry->reply_size;
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    return reply_size;
+}
+
+void cache_put(struct cache *const cache, const byte *const key, const usize key_size, const byte *const reply,
+               const usize reply_size) {
+    const uint_64 hash = hash_key(key, key_size);
+    struct shard *shard;
+    struct entry *entry = entry_of(cache, hash, &shard);
+    byte *bytes = malloc(key_size + reply_size), *old;
+
+    memcpy(bytes, key, key_size);
+    memcpy(bytes + key_size, reply, reply_size);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    old = entry->bytes;
+    entry->hash = hash;
+    entry->bytes = bytes;
+    entry->key_size = key_size;
+    entry->reply_size = reply_size;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    free(old);
+}
+
+void cache_destroy(struct cache *const cache) {
+    for (uint_8 i = 0; i < KEY_SHARDS; ++i) {
+        for (uint_32 j = 0; j < cache->shard_entries; ++j)
+            free(cache->shards[i].entries[j].bytes);
+
+        free(cache->shards[i].entries);
+        pthread_mutex_destroy(&cache->shards[i].mutex);
+    }
+
+    free(cache);
+}
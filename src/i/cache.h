@@ -0,0 +1,17 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_INVOKER_CACHE_H
+#define CSOCKET_INVOKER_CACHE_H
+
+#include "types/primitive.h"
+
+struct cache;
+
+struct cache *cache_new(uint_32 entries);
+
+usize cache_get(struct cache *, const byte *key, usize key_size, byte *reply, usize reply_capacity);
+
+void cache_put(struct cache *, const byte *key, usize key_size, const byte *reply, usize reply_size);
+
+void cache_destroy(struct cache *);
+
+#endif /* CSOCKET_INVOKER_CACHE_H */
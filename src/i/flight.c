@@ -0,0 +1,105 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "flight.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash.h"
+
+struct flight_call {
+    uint_64 hash;
+    byte *key;
+    usize key_size;
+    void **waiters;
+    usize waiters_count;
+    usize waiters_capacity;
+    struct flight_call *next;
+};
+
+struct shard {
+    pthread_mutex_t mutex;
+    struct flight_call *calls;
+};
+
+struct flight {
+    struct shard shards[KEY_SHARDS];
+};
+
+struct flight *flight_new(void) {
+    struct flight *flight = malloc(sizeof(struct flight));
+
+    for (uint_8 i = 0; i < KEY_SHARDS; ++i) {
+        pthread_mutex_init(&flight->shards[i].mutex, NULL);
+        flight->shards[i].calls = NULL;
+    }
+
+    return flight;
+}
+
+/* Returns the new call when no identical one is in flight, and the caller must execute it and then flight_end() it.
+ * Otherwise the caller's waiter is queued on the call in flight and NULL is returned: it now belongs to that call */
+struct flight_call *flight_begin(struct flight *const flight, const byte *const key, const usize key_size, void *const waiter) {
+    const uint_64 hash = hash_key(key, key_size);
+    struct shard *shard = &flight->shards[hash % KEY_SHARDS];
+    struct flight_call *call;
+
+    pthread_mutex_lock(&shard->mutex);
+
+    for (call = shard->calls; call != NULL; call = call->next) {
+        if (call->hash == hash && call->key_size == key_size && memcmp(call->key, key, key_size) == 0) {
+            if (call->waiters_count == call->waiters_capacity) {
+                call->waiters_capacity = call->waiters_capacity > 0 ? call->waiters_capacity * 2 : 4;
+                call->waiters = realloc(call->waiters, sizeof(void *) * call->waiters_capacity);
+            }
+
+            call->waiters[call->waiters_count++] = waiter;
+
+            pthread_mutex_unlock(&shard->mutex);
+
+            return NULL;
+        }
+    }
+
+    call = malloc(sizeof(struct flight_call));
+    call->hash = hash;
+    call->key = memcpy(malloc(key_size), key, key_size);
+    call->key_size = key_size;
+    call->waiters = NULL;
+    call->waiters_count = call->waiters_capacity = 0;
+    call->next = shard->calls;
+    shard->calls = call;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    return call;
+}
+
+/* Takes the call out of flight and hands its waiters, which the caller must free along with the array, back */
+void **flight_end(struct flight *const flight, struct flight_call *const call, usize *const waiters_count) {
+    struct shard *shard = &flight->shards[call->hash % KEY_SHARDS];
+    struct flight_call **link;
+    void **waiters;
+
+    pthread_mutex_lock(&shard->mutex);
+
+    for (link = &shard->calls; *link != call; link = &(*link)->next);
+
+    *link = call->next;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    waiters = call->waiters;
+    *waiters_count = call->waiters_count;
+
+    free(call->key);
+    free(call);
+
+    return waiters;
+}
+
+void flight_destroy(struct flight *const flight) {
+    for (uint_8 i = 0; i < KEY_SHARDS; ++i)
+        pthread_mutex_destroy(&flight->shards[i].mutex);
+
+    free(flight);
+}
@@ -0,0 +1,19 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_INVOKER_FLIGHT_H
+#define CSOCKET_INVOKER_FLIGHT_H
+
+#include "types/primitive.h"
+
+struct flight;
+
+struct flight_call;
+
+struct flight *flight_new(void);
+
+struct flight_call *flight_begin(struct flight *, const byte *key, usize key_size, void *waiter);
+
+void **flight_end(struct flight *, struct flight_call *, usize *waiters_count);
+
+void flight_destroy(struct flight *);
+
+#endif /* CSOCKET_INVOKER_FLIGHT_H */
@@ -0,0 +1,21 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_INVOKER_HASH_H
+#define CSOCKET_INVOKER_HASH_H
+
+#include "types/primitive.h"
+
+/* The tables keyed by the bytes of a request, the reply cache and the calls in flight, are split in as many shards,
+ * each with its own lock */
+#define KEY_SHARDS 16
+
+/* FNV-1a */
+static inline uint_64 hash_key(const byte *const key, const usize key_size) {
+    uint_64 hash = 14695981039346656037UL;
+
+    for (usize i = 0; i < key_size; ++i)
+        hash = (hash ^ key[i]) * 1099511628211UL;
+
+    return hash;
+}
+
+#endif /* CSOCKET_INVOKER_HASH_H */
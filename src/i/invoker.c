@@ -2,115 +2,388 @@
 #include "invoker.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
 #include <thpool/thpool.h>
 #include <errno.h>
 #include <m/marshaller.h>
 #include "rh/server.h"
+#include "rh/cpu.h"
+#include "cache.h"
+#include "flight.h"
+#include "queue.h"
+#include "co/coroutine.h"
 #include "log.h"
+#include "stats/clock.h"
+#include "stats/trace.h"
+#include "stats/metrics.h"
+#include "stats/recorder.h"
+#include "stats/capture.h"
+
+#define CACHED_REPLY_MAX 512
 
 struct invoker {
     enum protocol protocol;
     uint_16 port;
+    const char *path;
     threadpool thpool;
     uint_8 threads_num;
     struct service *service;
+    struct cache *cache;
+    struct flight *flight;
+    struct queue *queue;
+    struct scheduler **schedulers;
 };
 
-struct req {
+/* A request from the moment it is received until its reply is sent, which is also the handle async methods reply to */
+struct service_reply {
     const struct invoker *invoker;
     rh_client_msg *msg;
+    struct queue_entry entry;
+    uint_32 flags;
+    uint_64 enqueued_at;
+    char *service_name;
+    char *method;
+    struct data *request;
+    usize id_size;
+    usize header_size;
+    uint_64 budget_ns;
+    struct flight_call *call;
+    bool pure;
+    uint_64 stage_at;
+    uint_64 stages[TRACE_STAGES];
 };
 
-struct invoker *invoker_new(const enum protocol protocol, const uint_16 port, const uint_8 threads_num) {
+struct invoker *invoker_new(const enum protocol protocol, const uint_16 port, const char *const path,
+                            const uint_8 threads_num, const uint_32 cache_entries, const bool coroutines) {
     struct invoker *invoker = malloc(sizeof(struct invoker));
 
     invoker->protocol = protocol;
     invoker->port = port;
+    invoker->path = path;
     invoker->threads_num = threads_num;
-    invoker->thpool = thpool_init(threads_num * 2);
+    invoker->thpool = thpool_init(coroutines ? threads_num : threads_num * 2);
     invoker->service = NULL;
+    invoker->cache = cache_entries > 0 ? cache_new(cache_entries) : NULL;
+    invoker->flight = flight_new();
+    invoker->queue = NULL;
+    invoker->schedulers = NULL;
+
+    if (coroutines) {
+        invoker->schedulers = malloc(sizeof(struct scheduler *) * threads_num);
+
+        for (uint_8 i = 0; i < threads_num; ++i)
+            invoker->schedulers[i] = scheduler_new();
+    } else
+        invoker->queue = queue_new();
 
     return invoker;
 }
 
-static void process_req(struct req *req) {
+static void record_req(service_reply *const req, const usize reply_size, const enum recorder_outcome outcome) {
+    struct recorder_entry entry = {0};
+
+    entry.received_at = req->msg->received_at;
+    entry.request_size = (uint_32) req->msg->data_size;
+    entry.reply_size = (uint_32) reply_size;
+    entry.outcome = outcome;
+
+    req->stages[TRACE_RECEIVE] = req->msg->received_at - req->msg->ready_at;
+    req->stages[TRACE_ENQUEUE] = req->enqueued_at - req->msg->received_at;
+    memcpy(entry.stages, req->stages, sizeof(entry.stages));
+
+    if (req->method != NULL)
+        strncpy(entry.method, req->method, sizeof(entry.method) - 1);
+
+    rh_client_addr_peer(req->msg->return_addr, &entry.client_ip, &entry.client_port);
+
+    recorder_add(&entry);
+}
+
+/* A request that leads with an ID gets it back verbatim in front of its reply, so a multiplexing peer can route it */
+static enum recorder_outcome send_reply(service_reply *const req, const byte *const reply, const usize reply_size) {
+    byte framed[RH_FRAME_MAX];
+    uint_64 sent_at;
+
+    if (req->id_size > 0 && req->id_size + reply_size <= sizeof(framed)) {
+        memcpy(framed, req->msg->data, req->id_size);
+        memcpy(framed + req->id_size, reply, reply_size);
+
+        if (!rh_send_to_client(req->msg->return_addr, framed, req->id_size + reply_size))
+            return RECORDER_SEND_FAILED;
+    } else if (req->id_size > 0 || !rh_send_to_client(req->msg->return_addr, reply, reply_size))
+        return RECORDER_SEND_FAILED;
+
+    sent_at = trace_now();
+    req->stages[TRACE_SEND] = sent_at - req->stage_at;
+    req->stages[TRACE_TOTAL] = sent_at - req->msg->received_at;
+    trace_record(TRACE_TOTAL, req->msg->received_at, sent_at);
+    metrics_latency(clock_ticks_to_ns(clock_ticks() - req->msg->received_at));
+    log_print(NOISY, "Sent message with %ld bytes to client", reply_size);
+
+    return RECORDER_OK;
+}
+
+static void complete_req(service_reply *const req, const usize reply_size, const enum recorder_outcome outcome) {
+    metrics_add(outcome == RECORDER_OK ? METRIC_REQUESTS : outcome == RECORDER_EXPIRED ? METRIC_SHED : METRIC_ERRORS, 1);
+
+    if (recorder_enabled)
+        record_req(req, reply_size, outcome);
+
+    unmarshall_free(&req->service_name, &req->method, &req->request);
+    rh_client_msg_destroy(req->msg, false);
+    free(req);
+}
+
+static bool expired(const service_reply *const req) {
+    return req->budget_ns > 0 && clock_ticks_to_ns(clock_ticks() - req->msg->received_at) > req->budget_ns;
+}
+
+/* The caller already gave up on the request: a bare error tells it, or the peer multiplexing it, for less than the
+ * reply would cost */
+static void shed_req(service_reply *const req) {
+    struct value error = {0};
+
+    marshall_error(ETIMEDOUT, &error);
+
+    if (send_reply(req, error.value, error.size) != RECORDER_OK)
+        log_debug(DEBUG, errno, "Failed to send deadline exceeded reply");
+
+    marshall_free(&error);
+    complete_req(req, 0, RECORDER_EXPIRED);
+}
+
+/* Sends the reply of a coalesced call to every request that joined it while it was executing */
+static void answer_waiters(const struct invoker *const invoker, struct flight_call *const call, const byte *const reply,
+                           const usize reply_size) {
+    usize waiters_count;
+    void **waiters = flight_end(invoker->flight, call, &waiters_count);
+
+    for (usize i = 0; i < waiters_count; ++i) {
+        service_reply *waiter = waiters[i];
+
+        waiter->stage_at = trace_now();
+        complete_req(waiter, reply_size, reply_size > 0 ? send_reply(waiter, reply, reply_size) : RECORDER_NO_REPLY);
+    }
+
+    free(waiters);
+}
+
+void invoker_reply(service_reply *const req, const data *const reply) {
+    struct value bytes_value = {0};
+    enum recorder_outcome outcome = RECORDER_NO_REPLY;
+    usize reply_size = 0;
+
+    trace_lap(TRACE_EXECUTE, &req->stage_at, req->stages);
+
+    if (reply != NULL && data_size(reply) > 0) {
+        marshall(reply, NULL, NULL, &bytes_value);
+        trace_lap(TRACE_MARSHALL, &req->stage_at, req->stages);
+        reply_size = bytes_value.size;
+    }
+
+    if (reply_size > 0) {
+        /* a larger reply could never be served from the cache, it would only evict one that can */
+        if (req->pure && reply_size <= CACHED_REPLY_MAX)
+            cache_put(req->invoker->cache, req->msg->data + req->header_size, req->msg->data_size - req->header_size,
+                      bytes_value.value, reply_size);
+
+        outcome = send_reply(req, bytes_value.value, reply_size);
+    }
+
+    if (req->call != NULL)
+        answer_waiters(req->invoker, req->call, bytes_value.value, reply_size);
+
+    marshall_free(&bytes_value);
+    complete_req(req, reply_size, outcome);
+}
+
+static void process_req(service_reply *req) {
+    struct service *service = req->invoker->service;
     struct value bytes_value = {0};
-    char *service_name = NULL, *method = NULL;
-    struct data *request = NULL, *reply;
     struct service_instance *inst;
     service_method *func;
+    service_async_method *async_func = NULL;
+    struct data *reply;
+    byte cached[CACHED_REPLY_MAX];
+    usize cached_size;
+    uint_32 id, budget_us = 0;
+
+    req->stage_at = trace_now();
+    req->call = NULL;
+    req->pure = false;
+    memset(req->stages, 0, sizeof(req->stages));
+
+    trace_record(TRACE_QUEUE, req->enqueued_at, req->stage_at);
+    req->stages[TRACE_QUEUE] = req->stage_at - req->enqueued_at;
+    metrics_add(METRIC_DEQUEUED, 1);
 
     bytes_value.type = BYTES;
     bytes_value.size = req->msg->data_size;
     bytes_value.value = req->msg->data;
 
-    unmarshall(&bytes_value, &service_name, &method, &request);
+    req->service_name = req->method = NULL;
+    req->request = NULL;
+    req->id_size = unmarshall_request_id(&bytes_value, &id);
+    req->header_size = req->id_size + unmarshall_deadline(&bytes_value, req->id_size, &budget_us);
+    req->budget_ns = (uint_64) budget_us * 1000U;
 
-    if (request != NULL && service_name != NULL && method != NULL) {
-        inst = service_get_instance(req->invoker->service);
-        func = service_get_method(inst, method);
+    /* checked before anything else is spent on it, since it may have waited long in the queue */
+    if (expired(req)) {
+        shed_req(req);
+        return;
+    }
 
-        if (func != NULL) {
-            log_print(NOISY, "Received message with %ld bytes from client", bytes_value.size);
+    unmarshall(&bytes_value, &req->service_name, &req->method, &req->request);
+    trace_lap(TRACE_UNMARSHALL, &req->stage_at, req->stages);
 
-            reply = data_new(1);
+    if (req->request == NULL || req->service_name == NULL || req->method == NULL) {
+        complete_req(req, 0, RECORDER_BAD_REQUEST);
+        return;
+    }
 
-            func(request, reply);
+    req->pure = req->invoker->cache != NULL && (req->flags & METHOD_PURE);
 
-            if (data_size(reply) > 0) {
-                bytes_value.size = 0;
-                bytes_value.value = NULL;
+    /* the request bytes are the key: they hold the service, the method and the marshalled arguments, but neither the ID
+     * nor the deadline */
+    if (req->pure && (cached_size = cache_get(req->invoker->cache, req->msg->data + req->header_size,
+                                              req->msg->data_size - req->header_size, cached, sizeof(cached)))) {
+        metrics_add(METRIC_CACHE_HITS, 1);
+        complete_req(req, cached_size, send_reply(req, cached, cached_size));
+        return;
+    } else if (req->pure)
+        metrics_add(METRIC_CACHE_MISSES, 1);
 
-                marshall(reply, NULL, NULL, &bytes_value);
+    if ((req->flags & (METHOD_PURE | METHOD_IDEMPOTENT)) &&
+        NULL == (req->call = flight_begin(req->invoker->flight, req->msg->data + req->header_size,
+                                          req->msg->data_size - req->header_size, req))) {
+        metrics_add(METRIC_COALESCED, 1);
+        return;
+    }
 
-                if (bytes_value.size > 0 && rh_send_to_client(req->msg->return_addr, bytes_value.value, bytes_value.size)) {
-                    log_print(NOISY, "Sent message with %ld bytes to client", bytes_value.size);
-                }
+    inst = service_get_instance(service);
 
-                marshall_free(&bytes_value);
-            }
+    if (NULL == (func = service_get_method(inst, req->method)))
+        async_func = service_get_async_method(inst, req->method);
 
-            data_destroy(reply);
-        }
+    trace_lap(TRACE_ACQUIRE, &req->stage_at, req->stages);
+
+    log_print(NOISY, "Received message with %ld bytes from client", req->msg->data_size);
+
+    /* and again after waiting for an instance; a coalesced call runs anyway for the requests that joined it */
+    if ((func != NULL || async_func != NULL) && req->call == NULL && expired(req)) {
+        service_release_instance(service, inst);
+        shed_req(req);
+    } else if (func != NULL) {
+        reply = data_new(1);
+
+        func(req->request, reply);
+        service_release_instance(service, inst);
+        invoker_reply(req, reply);
+
+        data_destroy(reply);
+    } else if (async_func != NULL) {
+        /* req may already be completed and freed when this returns */
+        async_func(req->request, req);
+        service_release_instance(service, inst);
+    } else {
+        service_release_instance(service, inst);
 
-        service_release_instance(req->invoker->service, inst);
+        if (req->call != NULL)
+            answer_waiters(req->invoker, req->call, NULL, 0);
+
+        complete_req(req, 0, RECORDER_NO_METHOD);
     }
+}
 
-    unmarshall_free(&service_name, &method, &request);
-    rh_client_msg_destroy(req->msg, false);
-    free(req);
+/* The method is found in the frame as is, to pick the lane and the weight of the request before it is queued */
+static void classify_req(service_reply *const req) {
+    const struct value bytes_value = {.type = BYTES, .size = req->msg->data_size, .value = req->msg->data};
+    const char *method;
+    uint_8 size;
+
+    req->flags = NULL != (method = unmarshall_method(&bytes_value, 0, &size)) ?
+                 service_method_flags_sized(req->invoker->service, method, size) : 0;
+
+    req->entry.flow = rh_client_addr_flow(req->msg->return_addr);
+    req->entry.lane = METHOD_PRIORITY_OF(req->flags);
+    req->entry.weight = METHOD_WEIGHT_OF(req->flags);
+}
+
+static __attribute__((noreturn)) void run_worker(const struct invoker *const invoker) {
+    cpus_pin_all();
+
+    for (;; errno = 0)
+        process_req((service_reply *) ((byte *) queue_pop(invoker->queue) - offsetof(service_reply, entry)));
+}
+
+static __attribute__((noreturn)) void *run_scheduler(void *const scheduler) {
+    cpus_pin_all();
+    scheduler_run(scheduler);
 }
 
 static __attribute__((noreturn)) void run_server(const struct invoker *const invoker) {
     rh_server_ctx *server_ctx;
     rh_client_msg *msg;
-    struct req *req = NULL;
+    service_reply *req = NULL;
+    uint_64 received_at;
+    uint_8 next = 0;
+
+    /* before the server allocates anything, and binds the listener that the pinned CPU steers to */
+    cpus_pin_next();
 
-    if (NULL == (server_ctx = rh_server_new(invoker->protocol, invoker->port)))
+    if (NULL == (server_ctx = rh_server_new(invoker->protocol, invoker->port, invoker->path)))
         die(EXIT_FAILURE, errno, "Failed to start server");
     else
         log_print(INFO, "Server is running");
 
     for (;; errno = 0) {
         if (req == NULL)
-            req = malloc(sizeof(struct req));
+            req = malloc(sizeof(service_reply));
 
         if (NULL != (msg = rh_receive_from_client(server_ctx))) {
             req->msg = msg;
             req->invoker = invoker;
+            req->enqueued_at = trace_now();
+            received_at = msg->received_at;
+
+            if (capture_enabled)
+                capture_write(msg->data, msg->data_size);
+
+            classify_req(req);
 
-            thpool_add_work(invoker->thpool, (void (*)(void *)) process_req, req);
+            metrics_add(METRIC_ENQUEUED, 1);
+            if (invoker->schedulers != NULL)
+                scheduler_submit(invoker->schedulers[next++ % invoker->threads_num], (coroutine_func *) process_req, req);
+            else
+                queue_push(invoker->queue, &req->entry);
             req = NULL;
+
+            trace_record(TRACE_ENQUEUE, received_at, trace_now());
         }
     }
 }
 
 void invoker_run(struct invoker *const invoker, struct service *const service) {
+    pthread_t thread;
+
     invoker->service = service;
 
     for (uint_8 i = 0; i < invoker->threads_num; ++i)
         thpool_add_work(invoker->thpool, (void (*)(void *)) run_server, invoker);
 
+    /* the other half of the pool runs the workers serving the queue; the coroutine schedulers never give their thread
+     * back either, so they get threads of their own rather than the pool's, which is only sized for the reactors then */
+    for (uint_8 i = 0; i < invoker->threads_num; ++i) {
+        if (invoker->schedulers == NULL)
+            thpool_add_work(invoker->thpool, (void (*)(void *)) run_worker, invoker);
+        else if ((errno = pthread_create(&thread, NULL, run_scheduler, invoker->schedulers[i])) != 0)
+            die(EXIT_FAILURE, errno, "Failed to start scheduler");
+        else
+            pthread_detach(thread);
+    }
+
     thpool_wait(invoker->thpool);
     thpool_destroy(invoker->thpool);
 
@@ -8,8 +8,11 @@
 
 struct invoker;
 
-struct invoker *invoker_new(enum protocol, uint_16 port, uint_8 threads_num);
+struct invoker *invoker_new(enum protocol, uint_16 port, const char *path, uint_8 threads_num, uint_32 cache_entries,
+                            bool coroutines);
 
 __attribute__((noreturn)) void invoker_run(struct invoker *, struct service *);
 
+void invoker_reply(service_reply *, const data *reply);
+
 #endif /* CSOCKET_INVOKER_H */
@@ -0,0 +1,217 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "queue.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define FLOW_BUCKETS 256
+#define QUANTUM 1U
+
+/* The requests of one connection in one lane, which only exists while it has some */
+struct flow {
+    uint_64 key;
+    uint_8 lane;
+    uint_32 deficit;
+    struct flow *hash_next;
+    struct flow *next;
+    struct queue_entry *head;
+    struct queue_entry *tail;
+};
+
+/* The flows with requests, in the order of their turns */
+struct lane {
+    struct flow *head;
+    struct flow *tail;
+    usize count;
+};
+
+struct queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct lane lanes[QUEUE_LANES];
+    struct flow *buckets[FLOW_BUCKETS];
+    struct flow *free_flows;
+    usize count;
+    uint_32 passed;
+    uint_8 aging;
+};
+
+struct queue *queue_new(void) {
+    struct queue *queue = calloc(1, sizeof(struct queue));
+
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    return queue;
+}
+
+static struct flow **bucket_of(struct queue *const queue, const uint_64 key, const uint_8 lane) {
+    return &queue->buckets[(key ^ key >> 32 ^ lane) % FLOW_BUCKETS];
+}
+
+static struct flow *flow_get(struct queue *const queue, const uint_64 key, const uint_8 lane) {
+    struct flow **bucket = bucket_of(queue, key, lane);
+    struct flow *flow;
+
+    for (flow = *bucket; flow != NULL; flow = flow->hash_next) {
+        if (flow->key == key && flow->lane == lane)
+            return flow;
+    }
+
+    if (NULL != (flow = queue->free_flows))
+        queue->free_flows = flow->hash_next;
+    else
+        flow = malloc(sizeof(struct flow));
+
+    flow->key = key;
+    flow->lane = lane;
+    flow->deficit = QUANTUM;
+    flow->head = flow->tail = NULL;
+    flow->hash_next = *bucket;
+    *bucket = flow;
+
+    /* a new flow takes its first turn after every flow already waiting */
+    flow->next = NULL;
+
+    if (queue->lanes[lane].tail != NULL)
+        queue->lanes[lane].tail->next = flow;
+    else
+        queue->lanes[lane].head = flow;
+
+    queue->lanes[lane].tail = flow;
+
+    return flow;
+}
+
+/* Only called on the flow at the head of its lane, once it has no requests left */
+static void flow_free(struct queue *const queue, struct flow *const flow) {
+    struct flow **bucket = bucket_of(queue, flow->key, flow->lane);
+    struct lane *lane = &queue->lanes[flow->lane];
+
+    while (*bucket != flow)
+        bucket = &(*bucket)->hash_next;
+
+    *bucket = flow->hash_next;
+
+    if (NULL == (lane->head = flow->next))
+        lane->tail = NULL;
+
+    flow->hash_next = queue->free_flows;
+    queue->free_flows = flow;
+}
+
+void queue_push(struct queue *const queue, struct queue_entry *const entry) {
+    struct flow *flow;
+
+    if (entry->lane >= QUEUE_LANES)
+        entry->lane = QUEUE_LANES - 1;
+
+    if (entry->weight == 0)
+        entry->weight = 1;
+
+    entry->next = NULL;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    flow = flow_get(queue, entry->flow, entry->lane);
+
+    if (flow->tail != NULL)
+        flow->tail->next = entry;
+    else
+        flow->head = entry;
+
+    flow->tail = entry;
+    ++queue->lanes[entry->lane].count;
+    ++queue->count;
+
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* The highest lane with requests, unless it already passed over a lower one QUEUE_PASS_MAX times in a row: then each
+ * lower lane with requests gets its pop in turn */
+static struct lane *pick_lane(struct queue *const queue) {
+    uint_8 top = QUEUE_LANES, lower = 0;
+
+    while (queue->lanes[top - 1].count == 0)
+        --top;
+
+    for (uint_8 i = 0; i < top - 1; ++i)
+        lower += queue->lanes[i].count > 0;
+
+    if (lower == 0) {
+        queue->passed = 0;
+        return &queue->lanes[top - 1];
+    }
+
+    if (++queue->passed < QUEUE_PASS_MAX)
+        return &queue->lanes[top - 1];
+
+    queue->passed = 0;
+
+    while (queue->lanes[queue->aging % (top - 1)].count == 0)
+        ++queue->aging;
+
+    return &queue->lanes[queue->aging++ % (top - 1)];
+}
+
+struct queue_entry *queue_pop(struct queue *const queue) {
+    struct queue_entry *entry;
+    struct lane *lane;
+    struct flow *flow;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+
+    lane = pick_lane(queue);
+
+    /* a flow whose deficit does not cover its next request ends its turn, and gets the quantum for the next one */
+    for (flow = lane->head; flow->deficit < flow->head->weight; flow = lane->head) {
+        flow->deficit += QUANTUM;
+
+        if (flow->next != NULL) {
+            lane->head = flow->next;
+            lane->tail->next = flow;
+            lane->tail = flow;
+            flow->next = NULL;
+        }
+    }
+
+    entry = flow->head;
+    flow->deficit -= entry->weight;
+    --lane->count;
+    --queue->count;
+
+    if (NULL == (flow->head = entry->next)) {
+        flow->tail = NULL;
+        flow_free(queue, flow);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    entry->next = NULL;
+
+    return entry;
+}
+
+void queue_destroy(struct queue *const queue) {
+    struct flow *flow;
+
+    for (usize i = 0; i < FLOW_BUCKETS; ++i) {
+        while (NULL != (flow = queue->buckets[i])) {
+            queue->buckets[i] = flow->hash_next;
+            free(flow);
+        }
+    }
+
+    while (NULL != (flow = queue->free_flows)) {
+        queue->free_flows = flow->hash_next;
+        free(flow);
+    }
+
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+    free(queue);
+}
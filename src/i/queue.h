@@ -0,0 +1,32 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_INVOKER_QUEUE_H
+#define CSOCKET_INVOKER_QUEUE_H
+
+#include "types/primitive.h"
+
+/* Requests wait in one lane per method priority, and the highest lane with requests is served first, but for one in
+ * every QUEUE_PASS_MAX pops that goes to a lower one so that it never starves. Within a lane each flow, a connection,
+ * has its own FIFO and the flows take turns by deficit round-robin: a request of weight w costs its flow w turns */
+#define QUEUE_LANES 4
+#define QUEUE_PASS_MAX 32
+
+/* Embedded in the queued request, which the caller finds back from it */
+struct queue_entry {
+    struct queue_entry *next;
+    uint_64 flow;
+    uint_8 lane;
+    uint_8 weight;
+};
+
+struct queue;
+
+struct queue *queue_new(void);
+
+void queue_push(struct queue *, struct queue_entry *);
+
+/* Blocks until there is an entry to pop */
+struct queue_entry *queue_pop(struct queue *);
+
+void queue_destroy(struct queue *);
+
+#endif /* CSOCKET_INVOKER_QUEUE_H */
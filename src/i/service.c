@@ -4,10 +4,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include "co/coroutine.h"
 
 struct method {
     const char *method;
     void (*func)(const struct data *, struct data *);
+    service_async_method *async_func;
+    uint_32 flags;
+};
+
+/* A coroutine parked until an instance is released, from its own stack */
+struct waiter {
+    struct coroutine *co;
+    struct waiter *next;
 };
 
 struct service {
@@ -19,6 +28,8 @@ struct service {
     struct service_instance **instances;
     pthread_mutex_t instances_mutex;
     pthread_cond_t instances_cond;
+    struct waiter *waiters_head;
+    struct waiter *waiters_tail;
 };
 
 struct service_instance {
@@ -36,6 +47,7 @@ struct service *service_new(const char *const service_name, const uint_8 methods
     service->instances = malloc(sizeof(struct service_instance *) * instances_num);
     pthread_mutex_init(&service->instances_mutex, NULL);
     pthread_cond_init(&service->instances_cond, NULL);
+    service->waiters_head = service->waiters_tail = NULL;
 
     for (uint_8 i = 0; i < instances_num; ++i) {
         service->instances[i] = malloc(sizeof(struct service_instance));
@@ -45,19 +57,68 @@ struct service *service_new(const char *const service_name, const uint_8 methods
     return service;
 }
 
-void service_add_method(struct service *const service, const char *const method_name, service_method *const func) {
+void service_add_method(struct service *const service, const char *const method_name, service_method *const func,
+                        const uint_32 flags) {
     if (service->methods_count < service->methods_capacity) {
         service->methods[service->methods_count].method = method_name;
         service->methods[service->methods_count].func = func;
+        service->methods[service->methods_count].async_func = NULL;
+        service->methods[service->methods_count].flags = flags;
         ++service->methods_count;
     }
 }
 
+void service_add_async_method(struct service *const service, const char *const method_name,
+                              service_async_method *const async_func, const uint_32 flags) {
+    if (service->methods_count < service->methods_capacity) {
+        service->methods[service->methods_count].method = method_name;
+        service->methods[service->methods_count].func = NULL;
+        service->methods[service->methods_count].async_func = async_func;
+        service->methods[service->methods_count].flags = flags;
+        ++service->methods_count;
+    }
+}
+
+/* The methods table is only written before the invoker runs, so it can be read without an instance */
+uint_32 service_method_flags(const struct service *const service, const char *const method_name) {
+    return service_method_flags_sized(service, method_name, strlen(method_name));
+}
+
+uint_32 service_method_flags_sized(const struct service *const service, const char *const method_name, const usize size) {
+    for (uint_8 i = 0; i < service->methods_count; ++i) {
+        if (strlen(service->methods[i].method) == size && memcmp(method_name, service->methods[i].method, size) == 0)
+            return service->methods[i].flags;
+    }
+
+    return 0;
+}
+
+/* A coroutine parks instead of waiting on the condition, which would block every other coroutine of its thread, the
+ * instance holders included */
 struct service_instance *service_get_instance(struct service *const service) {
+    struct waiter waiter;
+
     pthread_mutex_lock(&service->instances_mutex);
 
-    while (service->instances_count == 0)
-        pthread_cond_wait(&service->instances_cond, &service->instances_mutex);
+    while (service->instances_count == 0) {
+        if (NULL == (waiter.co = coroutine_self())) {
+            pthread_cond_wait(&service->instances_cond, &service->instances_mutex);
+            continue;
+        }
+
+        waiter.next = NULL;
+
+        if (service->waiters_tail != NULL)
+            service->waiters_tail->next = &waiter;
+        else
+            service->waiters_head = &waiter;
+
+        service->waiters_tail = &waiter;
+
+        pthread_mutex_unlock(&service->instances_mutex);
+        coroutine_suspend();
+        pthread_mutex_lock(&service->instances_mutex);
+    }
 
     uint_8 i = --service->instances_count;
     struct service_instance *service_instance = service->instances[i];
@@ -78,11 +139,35 @@ service_method *service_get_method(const struct service_instance *const service_
     return NULL;
 }
 
+service_async_method *service_get_async_method(const struct service_instance *const service_instance,
+                                               const char *const method_name) {
+    for (uint_8 i = 0; i < service_instance->service->methods_count; ++i) {
+        if (strcmp(method_name, service_instance->service->methods[i].method) == 0) {
+            return service_instance->service->methods[i].async_func;
+        }
+    }
+
+    return NULL;
+}
+
 void service_release_instance(struct service *const service, struct service_instance *const service_instance) {
+    struct waiter *waiter;
+    struct coroutine *co = NULL;
+
     pthread_mutex_lock(&service->instances_mutex);
 
     service->instances[service->instances_count++] = service_instance;
 
-    pthread_cond_signal(&service->instances_cond);
+    if (NULL != (waiter = service->waiters_head)) {
+        if (NULL == (service->waiters_head = waiter->next))
+            service->waiters_tail = NULL;
+
+        co = waiter->co;
+    } else
+        pthread_cond_signal(&service->instances_cond);
+
     pthread_mutex_unlock(&service->instances_mutex);
+
+    if (co != NULL)
+        coroutine_wake(co);
 }
@@ -6,18 +6,48 @@
 
 typedef void (service_method)(const data *, data *);
 
+typedef struct service_reply service_reply;
+
+/* Replies later, from any thread, by passing the handle to invoker_reply() exactly once; the request stays valid until
+ * then, but the service instance is released as soon as the method returns */
+typedef void (service_async_method)(const data *, service_reply *);
+
+enum method_flag {
+    METHOD_PURE = 1U << 0,       /* the reply depends only on the arguments, so it may be cached */
+    METHOD_IDEMPOTENT = 1U << 1  /* identical calls in flight may share one execution, implied by METHOD_PURE */
+};
+
+/* Also or'ed into the flags: the invoker serves the calls of a higher priority first, and a call of weight w counts as w
+ * calls against the share of its connection. Both default to the lowest, priority 0 and weight 1 */
+#define METHOD_PRIORITIES 4
+#define METHOD_WEIGHT_MAX 15
+#define METHOD_PRIORITY(priority) (((uint_32) (priority) & 0x3U) << 8)
+#define METHOD_WEIGHT(weight) (((uint_32) (weight) & 0xFU) << 12)
+#define METHOD_PRIORITY_OF(flags) ((uint_8) ((flags) >> 8 & 0x3U))
+#define METHOD_WEIGHT_OF(flags) ((uint_8) ((flags) >> 12 & 0xFU))
+
 struct service;
 
 struct service_instance;
 
 struct service *service_new(const char *service_name, uint_8 methods_capacity, uint_8 instances_num);
 
-void service_add_method(struct service *, const char *method_name, service_method *);
+void service_add_method(struct service *, const char *method_name, service_method *, uint_32 flags);
+
+void service_add_async_method(struct service *, const char *method_name, service_async_method *, uint_32 flags);
+
+uint_32 service_method_flags(const struct service *, const char *method_name);
 
+/* The same for a method name that is not NUL-terminated, such as one still inside a request frame */
+uint_32 service_method_flags_sized(const struct service *, const char *method_name, usize size);
+
+/* Waits for a free instance, parking the calling coroutine if any */
 struct service_instance *service_get_instance(struct service *);
 
 service_method *service_get_method(const struct service_instance *, const char *method_name);
 
+service_async_method *service_get_async_method(const struct service_instance *, const char *method_name);
+
 void service_release_instance(struct service *service, struct service_instance *);
 
 #endif /* CSOCKET_INVOKER_SERVICE_H */
@@ -1,13 +1,62 @@
 /* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 199309L
+
 #include "log.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "types/primitive.h"
+
+#define RING_SIZE 65536U
+#define RING_STRING_MAX 255U
+#define LINE_SIZE 1024U
+#define RECORD_ALIGN 16U
+
+enum arg_type {
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+    ARG_NONE
+};
+
+/* A ring record is this header followed by the arguments of message_format in their binary form: 8 bytes per
+ * number or pointer, and a length byte followed by the characters per string. A header with a NULL format pads to
+ * the end of the ring. */
+struct record {
+    uint_16 size;
+    uint_8 log_lvl;
+    int err_num;
+    const char *message_format;
+};
+
+struct ring {
+    byte buffer[RING_SIZE] __attribute__((aligned(RECORD_ALIGN)));
+    uint_64 head;
+    uint_64 tail;
+    uint_64 dropped;
+    struct ring *next;
+};
 
 static enum log_level log_level = INFO;
 
+static bool async = false;
+
+static struct ring *rings = NULL;
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct ring *local = NULL;
+
 static __inline char error_prefix(const enum log_level log_lvl) {
     switch (log_lvl) {
         case FATAL:
@@ -40,6 +89,346 @@ static void error_log(const enum log_level log_lvl, const unsigned char status,
         exit(EXIT_FAILURE);
 }
 
+/* Walks one conversion specification starting right after '%', returning the type of its argument and the number of
+ * '*' fields in front of it, and leaving *format after the conversion character */
+static enum arg_type next_conversion(const char **const format, uint_8 *const stars) {
+    const char *f = *format;
+    uint_8 longs = 0;
+    bool size = false;
+
+    *stars = 0;
+
+    for (; *f != '\0' && strchr("-+ #0123456789.*", *f) != NULL; ++f) {
+        if (*f == '*')
+            ++*stars;
+    }
+
+    for (; *f != '\0' && strchr("hlzjt", *f) != NULL; ++f) {
+        if (*f == 'l')
+            ++longs;
+        else if (*f == 'z' || *f == 'j' || *f == 't')
+            size = true;
+    }
+
+    *format = *f != '\0' ? f + 1 : f;
+
+    switch (*f) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            return size ? ARG_SIZE : (longs >= 2 ? ARG_LLONG : (longs == 1 ? ARG_LONG : ARG_INT));
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            return ARG_DOUBLE;
+        case 's':
+            return ARG_STRING;
+        case 'p':
+            return ARG_POINTER;
+        default:
+            return ARG_NONE;
+    }
+}
+
+static bool capture_args(byte *const out, const usize capacity, const char *format, va_list args, usize *const captured) {
+    usize size = 0;
+    enum arg_type type;
+    uint_8 stars;
+
+    while (NULL != (format = strchr(format, '%'))) {
+        ++format;
+
+        if (*format == '%') {
+            ++format;
+            continue;
+        }
+
+        type = next_conversion(&format, &stars);
+
+        if (size + 8U * (stars + 1U) + RING_STRING_MAX + 1 > capacity)
+            return false;
+
+        for (; stars > 0; --stars, size += 8) {
+            int_64 v = va_arg(args, int);
+            memcpy(out + size, &v, 8);
+        }
+
+        switch (type) {
+            case ARG_INT: {
+                int_64 v = va_arg(args, int);
+                memcpy(out + size, &v, 8);
+                size += 8;
+            }
+                break;
+            case ARG_LONG: {
+                int_64 v = va_arg(args, long);
+                memcpy(out + size, &v, 8);
+                size += 8;
+            }
+                break;
+            case ARG_LLONG: {
+                int_64 v = va_arg(args, long long);
+                memcpy(out + size, &v, 8);
+                size += 8;
+            }
+                break;
+            case ARG_SIZE: {
+                uint_64 v = va_arg(args, usize);
+                memcpy(out + size, &v, 8);
+                size += 8;
+            }
+                break;
+            case ARG_DOUBLE: {
+                double v = va_arg(args, double);
+                memcpy(out + size, &v, 8);
+                size += 8;
+            }
+                break;
+            case ARG_POINTER: {
+                void *v = va_arg(args, void *);
+                memcpy(out + size, &v, sizeof(void *));
+                size += 8;
+            }
+                break;
+            case ARG_STRING: {
+                const char *v = va_arg(args, const char *);
+                usize len = v != NULL ? strlen(v) : 6;
+
+                len = len > RING_STRING_MAX ? RING_STRING_MAX : len;
+                out[size] = (byte) len;
+                memcpy(out + size + 1, v != NULL ? v : "(null)", len);
+                size += 1 + len;
+            }
+                break;
+            default:
+                break;
+        }
+    }
+
+    *captured = size;
+
+    return true;
+}
+
+static void format_args(char *const line, const usize capacity, const char *format, const byte *args) {
+    usize length = 0;
+    const char *spec;
+    char spec_format[32], string[RING_STRING_MAX + 1];
+    int star[2] = {0};
+    enum arg_type type;
+    uint_8 stars;
+    int written = 0;
+
+    while (length < capacity - 1 && *format != '\0') {
+        if (*format != '%' || format[1] == '%') {
+            line[length++] = *format;
+            format += *format == '%' ? 2 : 1;
+            continue;
+        }
+
+        spec = format++;
+        type = next_conversion(&format, &stars);
+
+        if ((usize) (format - spec) >= sizeof(spec_format) || stars > 2)
+            break;
+
+        memcpy(spec_format, spec, (usize) (format - spec));
+        spec_format[format - spec] = '\0';
+
+        for (uint_8 i = 0; i < stars; ++i, args += 8) {
+            int_64 v;
+            memcpy(&v, args, 8);
+            star[i] = (int) v;
+        }
+
+#define FORMAT_ARG(value) (stars == 2 ? snprintf(line + length, capacity - length, spec_format, star[0], star[1], value) : \
+                           stars == 1 ? snprintf(line + length, capacity - length, spec_format, star[0], value) : \
+                                        snprintf(line + length, capacity - length, spec_format, value))
+
+        switch (type) {
+            case ARG_INT:
+            case ARG_LONG:
+            case ARG_LLONG:
+            case ARG_SIZE: {
+                int_64 v;
+                memcpy(&v, args, 8);
+                args += 8;
+                written = type == ARG_INT ? FORMAT_ARG((int) v) : (type == ARG_LONG ? FORMAT_ARG((long) v) :
+                          (type == ARG_SIZE ? FORMAT_ARG((usize) v) : FORMAT_ARG((long long) v)));
+            }
+                break;
+            case ARG_DOUBLE: {
+                double v;
+                memcpy(&v, args, 8);
+                args += 8;
+                written = FORMAT_ARG(v);
+            }
+                break;
+            case ARG_POINTER: {
+                void *v;
+                memcpy(&v, args, sizeof(void *));
+                args += 8;
+                written = FORMAT_ARG(v);
+            }
+                break;
+            case ARG_STRING:
+                memcpy(string, args + 1, args[0]);
+                string[args[0]] = '\0';
+                args += 1 + args[0];
+                written = FORMAT_ARG(string);
+                break;
+            default:
+                written = 0;
+        }
+
+#undef FORMAT_ARG
+
+        if (written > 0)
+            length += (usize) written < capacity - length ? (usize) written : capacity - length - 1;
+    }
+
+    line[length] = '\0';
+}
+
+static struct ring *ring_register(void) {
+    struct ring *ring = calloc(1, sizeof(struct ring));
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    return ring;
+}
+
+/* Single producer: only the owning thread moves head, only the drain moves tail. Returns false when the arguments
+ * do not fit in a record, the message is then written synchronously. */
+static bool ring_push(const enum log_level log_lvl, const int err_num, const char *const message_format, va_list args) {
+    uint_64 record_buffer[LINE_SIZE / sizeof(uint_64)];
+    struct record *record = (struct record *) record_buffer;
+    usize args_size, size, offset, free_space;
+    uint_64 head, tail;
+
+    if (local == NULL)
+        local = ring_register();
+
+    if (!capture_args((byte *) record_buffer + sizeof(struct record), sizeof(record_buffer) - sizeof(struct record), message_format,
+                      args, &args_size))
+        return false;
+
+    size = (sizeof(struct record) + args_size + RECORD_ALIGN - 1) & ~(usize) (RECORD_ALIGN - 1);
+
+    record->size = (uint_16) size;
+    record->log_lvl = (uint_8) log_lvl;
+    record->err_num = err_num;
+    record->message_format = message_format;
+
+    head = local->head;
+    tail = __atomic_load_n(&local->tail, __ATOMIC_ACQUIRE);
+    offset = head % RING_SIZE;
+    free_space = RING_SIZE - (usize) (head - tail);
+
+    if (offset + size > RING_SIZE) {
+        if (free_space < RING_SIZE - offset + size) {
+            __atomic_fetch_add(&local->dropped, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        ((struct record *) &local->buffer[offset])->size = (uint_16) (RING_SIZE - offset);
+        ((struct record *) &local->buffer[offset])->message_format = NULL;
+        head += RING_SIZE - offset;
+        offset = 0;
+    } else if (free_space < size) {
+        __atomic_fetch_add(&local->dropped, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    memcpy(&local->buffer[offset], record_buffer, size);
+    __atomic_store_n(&local->head, head + size, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static bool drain(void) {
+    char line[LINE_SIZE];
+    struct ring *ring;
+    struct record *record;
+    uint_64 head, tail, dropped;
+    bool drained = false;
+
+    pthread_mutex_lock(&rings_mutex);
+    ring = rings;
+    pthread_mutex_unlock(&rings_mutex);
+
+    pthread_mutex_lock(&drain_mutex);
+
+    for (; ring != NULL; ring = ring->next) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (tail = ring->tail; tail < head; tail += record->size) {
+            record = (struct record *) &ring->buffer[tail % RING_SIZE];
+
+            if (record->message_format == NULL)
+                continue;
+
+            format_args(line, sizeof(line), record->message_format, (const byte *) record + sizeof(struct record));
+
+            if (record->err_num)
+                fprintf(stderr, "%c: %s: %s\n", error_prefix((enum log_level) record->log_lvl), line, strerror(record->err_num));
+            else
+                fprintf(stderr, "%c: %s\n", error_prefix((enum log_level) record->log_lvl), line);
+
+            drained = true;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if ((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) > 0)
+            fprintf(stderr, "W: %lu log messages dropped, ring full\n", (unsigned long) dropped);
+    }
+
+    if (drained)
+        fflush(stderr);
+
+    pthread_mutex_unlock(&drain_mutex);
+
+    return drained;
+}
+
+static __attribute__((noreturn)) void *drain_loop(void *const arg __attribute__((unused))) {
+    const struct timespec idle = {.tv_sec = 0, .tv_nsec = 1000000};
+
+    for (;;) {
+        if (!drain())
+            nanosleep(&idle, NULL);
+    }
+}
+
+void log_async_start(void) {
+    pthread_t thread;
+
+    if (async || pthread_create(&thread, NULL, drain_loop, NULL) != 0)
+        return;
+
+    pthread_detach(thread);
+    atexit(log_flush);
+    async = true;
+}
+
+void log_flush(void) {
+    if (async)
+        drain();
+}
+
 void log_increase_level(void) {
     if (log_level != SILENT)
         ++log_level;
@@ -49,22 +438,38 @@ void log_silence(void) {
     log_level = SILENT;
 }
 
-void log_print(const enum log_level log_lvl, const char *const message_format, ...) {
+static void log_write(const enum log_level log_lvl, const int err_num, const char *const message_format, va_list args) {
+    va_list copy;
+    bool pushed = false;
+
+    if (async && log_lvl != FATAL) {
+        va_copy(copy, args);
+        pushed = ring_push(log_lvl, err_num, message_format, copy);
+        va_end(copy);
+    }
+
+    if (!pushed) {
+        log_flush();
+        error_log(log_lvl, 0, err_num, message_format, args);
+    }
+}
+
+void (log_print)(const enum log_level log_lvl, const char *const message_format, ...) {
     if (log_lvl <= log_level) {
         va_list args;
 
         va_start(args, message_format);
-        error_log(log_lvl, 0, 0, message_format, args);
+        log_write(log_lvl, 0, message_format, args);
         va_end(args);
     }
 }
 
-void log_error(const enum log_level log_lvl, const int err_num, const char *const message_format, ...) {
+void (log_error)(const enum log_level log_lvl, const int err_num, const char *const message_format, ...) {
     if (log_lvl <= log_level) {
         va_list args;
 
         va_start(args, message_format);
-        error_log(log_lvl, 0, err_num, message_format, args);
+        log_write(log_lvl, err_num, message_format, args);
         va_end(args);
     }
 }
@@ -72,6 +477,8 @@ void log_error(const enum log_level log_lvl, const int err_num, const char *cons
 void die(const unsigned char status, const int err_num, const char *const message_format, ...) {
     va_list args;
 
+    log_flush();
+
     va_start(args, message_format);
     error_log(FATAL, status, err_num, message_format, args);
     va_end(args);
@@ -85,7 +492,7 @@ void log_debug(enum log_level log_lvl, int err_num, const char *const message_fo
         va_list args;
 
         va_start(args, message_format);
-        error_log(log_lvl, 0, err_num, message_format, args);
+        log_write(log_lvl, err_num, message_format, args);
         va_end(args);
     }
 }
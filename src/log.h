@@ -13,6 +13,7 @@
 #define EXIT_SUCCESS 0
 #define EXIT_MISTAKE 1
 #define EXIT_FAILURE 2
+#define EXIT_REGRESSION 3
 #define NOERR 0
 
 #define __UNUSED __attribute__((unused))
@@ -35,14 +36,26 @@ enum log_level {
     NOISY
 };
 
+/* Messages above LOG_LEVEL_MAX are compiled out, e.g. -DLOG_LEVEL_MAX=INFO drops every DEBUG and NOISY call site */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX NOISY
+#endif
+
 void log_increase_level(void);
 
 void log_silence(void);
 
+void log_async_start(void);
+
+void log_flush(void);
+
 void _PRINTF_FORMAT(2, 3) log_print(enum log_level, const char *message_format, ...);
 
 void _PRINTF_FORMAT(3, 4) log_error(enum log_level, int err_num, const char *message_format, ...);
 
+#define log_print(log_lvl, ...) ((log_lvl) <= LOG_LEVEL_MAX ? log_print(log_lvl, __VA_ARGS__) : (void) 0)
+#define log_error(log_lvl, ...) ((log_lvl) <= LOG_LEVEL_MAX ? log_error(log_lvl, __VA_ARGS__) : (void) 0)
+
 void _PRINTF_FORMAT(3, 4) __attribute__((noreturn)) die(unsigned char status, int err_num, const char *message_format, ...);
 
 #ifndef _CSOCKET_DEBUG
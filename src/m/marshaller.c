@@ -70,8 +70,92 @@ void marshall(const struct data *const data, const char *const service, const ch
     }
 }
 
+/* A request ID must lead the frame, so that multiplexed replies can be routed without unmarshalling them: call this on
+ * an empty value before marshall() */
+void marshall_request_id(uint_32 id, struct value *const value) {
+#if __BYTE_ORDER == __BIG_ENDIAN
+    id = __bswap_32(id);
+#endif
+
+    add_bytes(value, &id, 'Q', sizeof(uint_32));
+}
+
+/* Returns the size of the leading request ID element, which a reply must repeat, or 0 when the frame has none */
+usize unmarshall_request_id(const struct value *const value, uint_32 *const id) {
+    const byte *bytes = value->value;
+
+    if (value->size < 2 + sizeof(uint_32) || bytes[0] != 'Q' || bytes[1] != sizeof(uint_32))
+        return 0;
+
+    memcpy(id, &bytes[2], sizeof(uint_32));
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    *id = __bswap_32(*id);
+#endif
+
+    return 2 + sizeof(uint_32);
+}
+
+/* A deadline is the time the caller is still willing to wait, in µs, which does not need the clocks of both ends to
+ * agree: it follows the request ID, if any, so call this before marshall() too */
+void marshall_deadline(uint_32 budget_us, struct value *const value) {
+#if __BYTE_ORDER == __BIG_ENDIAN
+    budget_us = __bswap_32(budget_us);
+#endif
+
+    add_bytes(value, &budget_us, 'D', sizeof(uint_32));
+}
+
+/* Returns the size of the deadline element found at offset, right after the request ID, or 0 when the frame has none */
+usize unmarshall_deadline(const struct value *const value, const usize offset, uint_32 *const budget_us) {
+    const byte *bytes = (const byte *) value->value + offset;
+
+    if (value->size < offset + 2 + sizeof(uint_32) || bytes[0] != 'D' || bytes[1] != sizeof(uint_32))
+        return 0;
+
+    memcpy(budget_us, &bytes[2], sizeof(uint_32));
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+    *budget_us = __bswap_32(*budget_us);
+#endif
+
+    return 2 + sizeof(uint_32);
+}
+
+/* A reply made of an error code alone, which unmarshall() turns into errno instead of data */
+void marshall_error(const uint_8 code, struct value *const value) {
+    add_bytes(value, &code, 'E', sizeof(uint_8));
+}
+
+/* Returns the code of a reply made of an error alone, found at offset past the request ID if any, or 0 when the reply
+ * is anything else */
+uint_8 unmarshall_error(const struct value *const value, const usize offset) {
+    const byte *bytes = value->value;
+
+    if (value->size != offset + 2 + sizeof(uint_8) || bytes[offset] != 'E' || bytes[offset + 1] != sizeof(uint_8))
+        return 0;
+
+    return bytes[offset + 2];
+}
+
+/* Finds the method name in place, without copying anything, so that a request can be classified before it is unmarshalled:
+ * returns NULL when the frame has none before its first argument */
+const char *unmarshall_method(const struct value *const value, usize offset, uint_8 *const size) {
+    const byte *bytes = value->value;
+
+    for (; offset + 2 <= value->size && offset + 2 + bytes[offset + 1] <= value->size; offset += 2 + bytes[offset + 1]) {
+        if (bytes[offset] == 'M') {
+            *size = bytes[offset + 1];
+            return (const char *) &bytes[offset + 2];
+        } else if (bytes[offset] != 'S' && bytes[offset] != 'Q' && bytes[offset] != 'D')
+            break;
+    }
+
+    return NULL;
+}
+
 void unmarshall(const struct value *const value, char **const service, char **const method, struct data **const data) {
-    uint_8 i;
+    usize i;
     void *bytes = NULL;
     byte marker;
     uint_8 size = 0;
@@ -98,6 +182,15 @@ void unmarshall(const struct value *const value, char **const service, char **co
                     (*method)[size] = '\0';
                 }
                 continue;
+            case 'Q':
+            case 'D':
+                continue;
+            case 'E':
+                data_destroy(*data);
+                *data = NULL;
+                errno = size == sizeof(uint_8) ? *(byte *) bytes : EPROTO;
+                free(bytes);
+                return;
             case 'B':
                 type = BYTES;
                 break;
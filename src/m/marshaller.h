@@ -5,6 +5,20 @@
 
 void marshall(const struct data *, const char *service, const char *method, struct value *);
 
+void marshall_request_id(uint_32 id, struct value *);
+
+usize unmarshall_request_id(const struct value *, uint_32 *id);
+
+void marshall_deadline(uint_32 budget_us, struct value *);
+
+usize unmarshall_deadline(const struct value *, usize offset, uint_32 *budget_us);
+
+void marshall_error(uint_8 code, struct value *);
+
+uint_8 unmarshall_error(const struct value *, usize offset);
+
+const char *unmarshall_method(const struct value *, usize offset, uint_8 *size);
+
 void unmarshall(const struct value *, char **service, char **method, struct data **);
 
 void marshall_free(struct value *value);
@@ -7,29 +7,59 @@
 #include <time.h>
 #include <signal.h>
 #include <limits.h>
+#include <errno.h>
 #include "log.h"
 #include "rh/types.h"
+#include "rh/server.h"
+#include "rh/cpu.h"
 #include "np/naming_proxy.h"
 #include "server.h"
 #include "client.h"
+#include "proxy.h"
+#include "stats/trace.h"
+#include "stats/recorder.h"
+#include "stats/capture.h"
+#include "stats/metrics.h"
+#include "supervisor.h"
 
-static const char optstring[] = "b:chI:p:qsS:tT:uv";
+static const char optstring[] = "B:b:cf:hI:K:o:P:p:qsS:tT:uvw:";
 static const struct option longopts[] = {
-        {"benchmark", required_argument, NULL, 'b'},
-        {"client",    no_argument,       NULL, 'c'},
-        {"help",      no_argument,       NULL, 'h'},
-        {"instances", required_argument, NULL, 'I'},
-        {"port",      required_argument, NULL, 'p'},
-        {"server",    no_argument,       NULL, 's'},
-        {"service",   required_argument, NULL, 'S'},
-        {"tcp",       no_argument,       NULL, 't'},
-        {"threads",   required_argument, NULL, 'T'},
-        {"udp",       no_argument,       NULL, 'u'},
-        {NULL,        no_argument,       NULL, '\0'}
+        {"baseline",     required_argument, NULL, 'B'},
+        {"benchmark",    required_argument, NULL, 'b'},
+        {"c10k",         required_argument, NULL, 'K'},
+        {"cache",        required_argument, NULL, 'M'},
+        {"capture",      required_argument, NULL, 'C'},
+        {"client",       no_argument,       NULL, 'c'},
+        {"coroutines",   no_argument,       NULL, 'O'},
+        {"cpus",         required_argument, NULL, 'A'},
+        {"format",       required_argument, NULL, 'f'},
+        {"help",         no_argument,       NULL, 'h'},
+        {"idle-timeout", required_argument, NULL, 'L'},
+        {"in-flight",    required_argument, NULL, 'F'},
+        {"instances",    required_argument, NULL, 'I'},
+        {"output",       required_argument, NULL, 'o'},
+        {"port",         required_argument, NULL, 'p'},
+        {"proxy",        optional_argument, NULL, 'X'},
+        {"recorder",     required_argument, NULL, 'y'},
+        {"replay",       required_argument, NULL, 'P'},
+        {"scenario",     required_argument, NULL, 'w'},
+        {"server",       no_argument,       NULL, 's'},
+        {"service",      required_argument, NULL, 'S'},
+        {"shm",          required_argument, NULL, 'H'},
+        {"stats",        required_argument, NULL, 'm'},
+        {"tcp",          no_argument,       NULL, 't'},
+        {"threads",      required_argument, NULL, 'T'},
+        {"threshold",    required_argument, NULL, 'R'},
+        {"trace",        no_argument,       NULL, 'x'},
+        {"udp",          no_argument,       NULL, 'u'},
+        {"unix",         required_argument, NULL, 'U'},
+        {"unixpacket",   required_argument, NULL, 'N'},
+        {"workers",      required_argument, NULL, 'W'},
+        {NULL,           no_argument,       NULL, '\0'}
 };
 
 static void __attribute__((noreturn)) usage(const uint_8 status, const char *const progname) {
-    fprintf((status != 0) ? stderr : stdout, "Usage: %s [-c | -s [-t | -u] -p PORT ]\n", progname);
+    fprintf((status != 0) ? stderr : stdout, "Usage: %s [-c | [-s | --proxy -S SERVICE] [-t | -u] -p PORT | [-s | --proxy -S SERVICE] --unix=PATH ]\n", progname);
 
     if (status != 0) {
         fprintf(stderr, "Try '%s --help' for more information.\n", progname);
@@ -39,26 +69,64 @@ static void __attribute__((noreturn)) usage(const uint_8 status, const char *con
     printf("Run a client/server application supporting concurrent TCP/UDP connections and test the response time.\n\n");
 
     printf("Mode selection and protocol control:\n");
-    printf("  -b, --benchmark=NUM  send NUM requests and print the response time\n");
+    printf("  -b, --benchmark=NUM  send NUM requests and print the response time percentiles\n");
+    printf("  -f, --format=FORMAT  benchmark report format: text, json or csv (default: text)\n");
+    printf("  -o, --output=FILE    write the benchmark report to FILE instead of stdout\n");
+    printf("  -B, --baseline=FILE  compare against a saved json/csv report and fail on regressions\n");
+    printf("      --threshold=PCT  allowed p99/throughput regression against the baseline (default: 10)\n");
+    printf("  -w, --scenario=SPEC  benchmark scenario NAME[:KEY=VALUE,...], may be repeated; NAME is a preset\n");
+    printf("                       (default, mix, churn, sweep) or free text, KEY is add/sub/mul/div (weights),\n");
+    printf("                       payload (padding bytes, '/' separated sweep), connect (keepalive or request),\n");
+    printf("                       think (µs between requests), deadline (µs the server has to answer) or requests\n");
+    printf("  -K, --c10k=SPEC      hold CONNS[:step=N,rate=REQ/S,duration=SEC,pid=SERVER_PID] concurrent connections,\n");
+    printf("                       ramping up by step, each sending rate requests per second for duration seconds\n");
+    printf("  -P, --replay=SPEC    re-send the frames of a PATH[:speed=N] capture at N times their original pace\n");
+    printf("                       (default: 1, 0 sends them back to back)\n");
     printf("  -c, --client         run as client\n");
     printf("  -s, --server         run as server\n");
+    printf("      --proxy[=NUM]    run as proxy, forwarding each request to its -S service over NUM multiplexed\n");
+    printf("                       connections per service (default: 2)\n");
     printf("  -t, --tcp            use the Transmission Control Protocol (TCP)\n");
     printf("  -u, --udp            use the User Datagram Protocol (UDP)\n");
     printf("  -p, --port=PORT      use PORT as the TCP/UDP port\n");
+    printf("      --unix=PATH      listen on the Unix stream socket PATH instead of a TCP/UDP port\n");
+    printf("      --unixpacket=PATH\n");
+    printf("                       same as --unix, on a Unix seqpacket socket\n");
+    printf("      --shm=PATH       serve clients over shared memory rings, set up on the Unix socket PATH\n");
     printf("  -T, --threads        number of server threads (default: 4)\n");
     printf("  -I, --instances      number of service instances (default: 10)\n");
+    printf("      --coroutines     run requests as coroutines that yield while a method waits on a requestor\n");
+    printf("      --cpus=LIST      pin each server thread to the next CPU of LIST (e.g. 0-3,8) and the workers to all\n");
+    printf("                       of them, steering each TCP/UDP listener the requests received on its CPU\n");
+    printf("      --workers=N      fork N server processes sharing the port, or path, under a supervisor that restarts\n");
+    printf("                       those that die and serves the --stats of them all; --cpus is split between them\n");
+    printf("      --stats=PATH     serve request, byte, error, connection and latency metrics on the Unix socket PATH\n");
+    printf("      --cache=ENTRIES  cache up to ENTRIES replies of pure methods, 0 disables it (default: 4096)\n");
+    printf("      --idle-timeout=SEC\n");
+    printf("                       close connections without requests nor replies for SEC seconds, 0 never does\n");
+    printf("                       (default: 0)\n");
+    printf("      --in-flight=N    stop reading from connections with N requests in flight until some are answered,\n");
+    printf("                       0 never does (default: 0)\n");
+    printf("      --capture=PATH   write every received frame with its arrival time to PATH, for --replay\n");
+    printf("      --trace          time every request stage per thread, SIGUSR1 dumps the breakdown to stderr\n");
+    printf("      --recorder=SPEC  keep the last ENTRIES[:threshold=USEC,file=PATH] requests with their stage timings,\n");
+    printf("                       dumped on SIGUSR2 or when a request takes longer than threshold µs (default: stderr)\n");
     printf("  -S, --service        service address in the format <SERVICE_NAME>+<PROTO>://<HOSTNAME>:<PORT>\n");
+    printf("                       or <SERVICE_NAME>+unix:///<PATH> (unixpacket:///<PATH> for seqpacket, shm:///<PATH>\n");
+    printf("                       for shared memory)\n");
     printf("  -h, --help           display this help text and exit\n");
 
     exit(status);
 }
 
 int main(int argc, char *argv[]) {
-    const char *progname = "csocket";
+    const char *progname = "csocket", *stats_path = NULL, *capture_path = NULL, *unix_path = NULL;
     int_32 opt;
-    bool client = false, server = false, tcp = false, udp = false;
-    uint_16 benchmark = 0, port = 0;
-    uint_8 threads_num = 4, instances_num = 10;
+    bool client = false, server = false, proxy = false, seqpacket = false, shm = false, tcp = false, udp = false, trace = false, recorder = false, coroutines = false;
+    struct benchmark_options benchmark = {.format = TEXT, .threshold = 10};
+    uint_16 port = 0;
+    uint_8 threads_num = 4, instances_num = 10, upstreams_num = 2, workers_num = 0;
+    uint_32 cache_entries = 4096;
 
     srand((uint_32) (time(NULL) - 16777215U));
 
@@ -69,15 +137,22 @@ int main(int argc, char *argv[]) {
             case 'b': {
                 char *endptr;
                 long optval = strtol(optarg, &endptr, 10);
-                benchmark = (uint_16) optval;
+                benchmark.requests = (uint_32) optval;
 
-                if (*endptr != '\0' || optval <= 0 || optval > USHRT_MAX || endptr == optarg)
+                if (*endptr != '\0' || optval <= 0 || optval > (long) UINT32_MAX || endptr == optarg)
                     die(EXIT_MISTAKE, 0, "%s: invalid benchmark argument", optarg);
             }
                 break;
+            case 'B':
+                benchmark.baseline = optarg;
+                break;
             case 'c':
                 client = true;
                 break;
+            case 'f':
+                if (!bm_format_parse(optarg, &benchmark.format))
+                    die(EXIT_MISTAKE, 0, "%s: invalid format argument", optarg);
+                break;
             case 'h':
                 usage(EXIT_SUCCESS, progname);
             case 'I': {
@@ -89,6 +164,69 @@ int main(int argc, char *argv[]) {
                     die(EXIT_MISTAKE, 0, "%s: invalid instances argument", optarg);
             }
                 break;
+            case 'C':
+                capture_path = optarg;
+                break;
+            case 'M': {
+                char *endptr;
+                long optval = strtol(optarg, &endptr, 10);
+                cache_entries = (uint_32) optval;
+
+                if (*endptr != '\0' || optval < 0 || optval > 16777216 || endptr == optarg)
+                    die(EXIT_MISTAKE, 0, "%s: invalid cache argument", optarg);
+            }
+                break;
+            case 'O':
+                coroutines = true;
+                break;
+            case 'A':
+                if (!cpus_parse(optarg))
+                    die(EXIT_MISTAKE, 0, "%s: invalid CPU list", optarg);
+                break;
+            case 'L': {
+                char *endptr;
+                long optval = strtol(optarg, &endptr, 10);
+
+                if (*endptr != '\0' || optval < 0 || optval > 86400 || endptr == optarg)
+                    die(EXIT_MISTAKE, 0, "%s: invalid idle timeout argument", optarg);
+
+                rh_server_set_idle_timeout((uint_32) optval);
+            }
+                break;
+            case 'F': {
+                char *endptr;
+                long optval = strtol(optarg, &endptr, 10);
+
+                if (*endptr != '\0' || optval < 0 || optval > UINT16_MAX || endptr == optarg)
+                    die(EXIT_MISTAKE, 0, "%s: invalid in-flight argument", optarg);
+
+                rh_server_set_in_flight_limit((uint_32) optval);
+            }
+                break;
+            case 'W': {
+                char *endptr;
+                long optval = strtol(optarg, &endptr, 10);
+
+                if (*endptr != '\0' || optval <= 0 || optval > CHAR_MAX || endptr == optarg)
+                    die(EXIT_MISTAKE, 0, "%s: invalid workers argument", optarg);
+
+                workers_num = (uint_8) optval;
+            }
+                break;
+            case 'K':
+                if (!c10k_parse(optarg, &benchmark.c10k))
+                    die(EXIT_MISTAKE, 0, "%s: invalid c10k argument", optarg);
+                break;
+            case 'm':
+                stats_path = optarg;
+                break;
+            case 'o':
+                benchmark.output = optarg;
+                break;
+            case 'P':
+                if (!replay_parse(optarg, &benchmark.replay))
+                    die(EXIT_MISTAKE, 0, "%s: invalid replay argument", optarg);
+                break;
             case 'p': {
                 char *endptr;
                 long optval = strtol(optarg, &endptr, 10);
@@ -101,6 +239,14 @@ int main(int argc, char *argv[]) {
             case 'q':
                 log_silence();
                 break;
+            case 'R': {
+                char *endptr;
+                benchmark.threshold = strtod(optarg, &endptr);
+
+                if (*endptr != '\0' || benchmark.threshold < 0 || endptr == optarg)
+                    die(EXIT_MISTAKE, 0, "%s: invalid threshold argument", optarg);
+            }
+                break;
             case 's':
                 server = true;
                 break;
@@ -115,6 +261,18 @@ int main(int argc, char *argv[]) {
                     usage(EXIT_MISTAKE, progname);
             }
                 break;
+            case 'X':
+                proxy = true;
+
+                if (optarg != NULL) {
+                    char *endptr;
+                    long optval = strtol(optarg, &endptr, 10);
+                    upstreams_num = (uint_8) optval;
+
+                    if (*endptr != '\0' || optval <= 0 || optval > CHAR_MAX || endptr == optarg)
+                        die(EXIT_MISTAKE, 0, "%s: invalid proxy argument", optarg);
+                }
+                break;
             case 't':
                 tcp = true;
                 break;
@@ -130,22 +288,80 @@ int main(int argc, char *argv[]) {
             case 'u':
                 udp = true;
                 break;
+            case 'H':
+                shm = true;
+                unix_path = optarg;
+                break;
+            case 'N':
+                seqpacket = true;
+                /* fall through */
+            case 'U':
+                unix_path = optarg;
+                break;
+            case 'x':
+                trace = true;
+                break;
+            case 'y':
+                if (!recorder_parse(optarg))
+                    die(EXIT_MISTAKE, 0, "%s: invalid recorder argument", optarg);
+
+                recorder = true;
+                break;
             case 'v':
                 log_increase_level();
                 break;
+            case 'w':
+                if (benchmark.scenarios_count == UINT8_MAX)
+                    die(EXIT_MISTAKE, 0, "too many scenarios");
+
+                benchmark.scenarios = realloc(benchmark.scenarios, sizeof(struct scenario) * (benchmark.scenarios_count + 1U));
+
+                if (!scenario_parse(optarg, &benchmark.scenarios[benchmark.scenarios_count++]))
+                    die(EXIT_MISTAKE, 0, "%s: invalid scenario argument", optarg);
+                break;
             default:
                 usage(EXIT_MISTAKE, progname);
         }
     }
 
-    if ((!client && !server) || (server && ((!tcp && !udp) || !port)) || (client && (tcp || udp || port)) || (benchmark > 0 && !client)) {
+    if ((!client && !server && !proxy) || (client + server + proxy > 1) || ((server || proxy) && (tcp + udp + (unix_path != NULL) != 1 || (unix_path != NULL) == (port != 0))) || (client && (tcp || udp || port || unix_path)) || ((benchmark.requests > 0 || benchmark.scenarios_count > 0 || benchmark.c10k.connections > 0 || benchmark.replay.path != NULL) && !client) || (capture_path != NULL && (!server || workers_num > 0)) || (workers_num > 0 && client)) {
         usage(EXIT_MISTAKE, progname);
     }
 
-    if (server) {
-        run_server(tcp ? TCP : UDP, port, threads_num, instances_num);
-    } else if (benchmark) {
-        return run_client_benchmark(benchmark);
+    if (server || proxy) {
+        const enum protocol protocol = unix_path != NULL ? (shm ? SHM : seqpacket ? SEQPACKET : UNIX) : (tcp ? TCP : UDP);
+
+        /* before any thread starts, as only the forking one would carry on in the workers */
+        if (workers_num > 0) {
+            if (!rh_server_share(protocol, unix_path))
+                die(EXIT_FAILURE, errno, "%s: failed to listen", unix_path);
+
+            cpus_partition(supervise(workers_num, stats_path), workers_num);
+        }
+
+        if (trace)
+            trace_enable();
+
+        if (recorder)
+            recorder_enable();
+
+        log_async_start();
+
+        if (stats_path != NULL && workers_num == 0 && !metrics_serve(stats_path))
+            die(EXIT_FAILURE, errno, "%s: failed to serve metrics", stats_path);
+
+        if (capture_path != NULL && !capture_start(capture_path))
+            die(EXIT_FAILURE, errno, "%s: failed to start capture", capture_path);
+
+        if (proxy)
+            run_proxy(protocol, port, unix_path, threads_num, upstreams_num);
+
+        run_server(protocol, port, unix_path, threads_num, instances_num, cache_entries, coroutines);
+    } else if (benchmark.requests || benchmark.scenarios_count || benchmark.c10k.connections || benchmark.replay.path) {
+        if (benchmark.requests == 0)
+            benchmark.requests = 1000;
+
+        return run_client_benchmark(&benchmark);
     } else {
         run_client();
     }
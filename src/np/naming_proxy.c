@@ -30,13 +30,27 @@ bool np_add_service(const char *service_name __attribute__((unused)), const char
 
     strcpy(service_address, hostname);
 
-    proto = strtok(service_address, ":");
-    address = strtok(NULL, "://");
-    port = strtok(NULL, ":");
+    /* unix:///PATH, unixpacket:///PATH and shm:///PATH keep the whole absolute path as the address, with no port */
+    if (strncmp("unix://", hostname, 7) == 0 || strncmp("unixpacket://", hostname, 13) == 0 || strncmp("shm://", hostname, 6) == 0) {
+        address = strstr(service_address, "://") + 3;
+        *strstr(service_address, "://") = '\0';
+        proto = service_address;
+        port_number = 0;
 
-    port_number = strtol(port, &endptr, 10);
-    if (*endptr != '\0' || port_number <= 0 || port_number > USHRT_MAX || endptr == port)
-        return false;
+        if (*address != '/')
+            return false;
+    } else {
+        proto = strtok(service_address, ":");
+        address = strtok(NULL, "://");
+        port = strtok(NULL, ":");
+
+        if (address == NULL || port == NULL)
+            return false;
+
+        port_number = strtol(port, &endptr, 10);
+        if (*endptr != '\0' || port_number <= 0 || port_number > USHRT_MAX || endptr == port)
+            return false;
+    }
 
     services[services_count].service_name = malloc(strlen(service_name) + 1);
     strcpy(services[services_count].service_name, service_name);
@@ -46,6 +60,12 @@ bool np_add_service(const char *service_name __attribute__((unused)), const char
 
     if (strcmp("tcp", proto) == 0)
         services[services_count].protocol = TCP;
+    else if (strcmp("unix", proto) == 0)
+        services[services_count].protocol = UNIX;
+    else if (strcmp("unixpacket", proto) == 0)
+        services[services_count].protocol = SEQPACKET;
+    else if (strcmp("shm", proto) == 0)
+        services[services_count].protocol = SHM;
     else
         services[services_count].protocol = UDP;
 
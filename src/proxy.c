@@ -0,0 +1,401 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "proxy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+#include "m/marshaller.h"
+#include "np/naming_proxy.h"
+#include "r/requestor.h"
+#include "rh/server.h"
+#include "rh/cpu.h"
+#include "stats/clock.h"
+#include "stats/metrics.h"
+
+#define IN_FLIGHT_MAX 4096
+#define BACKENDS_MAX 16
+#define REQUEST_ID_SIZE (2 + sizeof(uint_32))
+#define BACKOFF_MIN_MS 10
+#define BACKOFF_MAX_MS 1000
+
+/* A client request waiting for its reply, which is routed back by the ID it was forwarded with */
+struct forward {
+    rh_client_msg *msg;
+    bool sent;
+    uint_32 upstream_id;
+    usize id_size;
+    byte id[REQUEST_ID_SIZE];
+};
+
+/* One backend connection, shared by every client request the reactors send its way. Connecting blocks, so only its
+ * reader thread does it, once a request is parked waiting for the connection: while a failed attempt backs off, the
+ * requests are failed right away instead */
+struct upstream {
+    const struct host_addr *host_addr;
+    pthread_mutex_t lock;
+    pthread_cond_t demand;
+    struct requestor *requestor;
+    uint_32 parked;
+    bool backing_off;
+    uint_32 next_id;
+    struct forward in_flight[IN_FLIGHT_MAX];
+};
+
+struct backend {
+    const struct host_addr *host_addr;
+    struct upstream *upstreams;
+    uint_32 next;
+};
+
+struct proxy {
+    enum protocol protocol;
+    uint_16 port;
+    const char *path;
+    uint_8 upstreams_num;
+    pthread_mutex_t lock;
+    struct backend backends[BACKENDS_MAX];
+    uint_8 backends_count;
+};
+
+/* Tells the client its request will not be answered with an error reply behind its own request ID, if it sent one,
+ * instead of leaving it to wait for its timeout */
+static void fail_req(rh_client_msg *const msg, const byte *const id, const usize id_size, const uint_8 code) {
+    struct value error = {0};
+    byte framed[REQUEST_ID_SIZE + 8];
+
+    marshall_error(code, &error);
+    memcpy(framed, id, id_size);
+    memcpy(framed + id_size, error.value, error.size);
+
+    if (!rh_send_to_client(msg->return_addr, framed, id_size + error.size))
+        log_debug(DEBUG, errno, "Failed to send error reply");
+
+    marshall_free(&error);
+    rh_client_msg_destroy(msg, false);
+
+    metrics_add(METRIC_ERRORS, 1);
+}
+
+/* Called with the upstream locked */
+static void fail_forward(struct upstream *const upstream, struct forward *const forward, const uint_8 code) {
+    if (!forward->sent)
+        --upstream->parked;
+
+    fail_req(forward->msg, forward->id, forward->id_size, code);
+    forward->msg = NULL;
+}
+
+/* Called with the upstream locked, once it is connected */
+static bool send_forward(struct upstream *const upstream, struct forward *const forward) {
+    const rh_client_msg *msg = forward->msg;
+
+    if (!requestor_send(upstream->requestor, forward->upstream_id, msg->data + forward->id_size, msg->data_size - forward->id_size))
+        return false;
+
+    forward->sent = true;
+    --upstream->parked;
+
+    return true;
+}
+
+/* Sends the requests parked while connecting, or fails them when it did not work out */
+static void flush_parked(struct upstream *const upstream, const uint_8 code) {
+    for (uint_32 i = 0; i < IN_FLIGHT_MAX && upstream->parked > 0; ++i) {
+        struct forward *forward = &upstream->in_flight[i];
+
+        if (forward->msg != NULL && !forward->sent && (upstream->requestor == NULL || !send_forward(upstream, forward)))
+            fail_forward(upstream, forward, code);
+    }
+}
+
+/* Blocks until a request waits for the connection, then connects, backing off for a while after a failed attempt */
+static struct requestor *connect_upstream(struct upstream *const upstream, uint_32 *const backoff_ms) {
+    struct requestor *requestor;
+    struct timespec backoff;
+
+    pthread_mutex_lock(&upstream->lock);
+
+    while (upstream->parked == 0)
+        pthread_cond_wait(&upstream->demand, &upstream->lock);
+
+    pthread_mutex_unlock(&upstream->lock);
+
+    if (NULL == (requestor = requestor_new(upstream->host_addr)))
+        log_error(WARN, errno, "%s: failed to connect upstream, retrying in %u ms", upstream->host_addr->service_name,
+                  *backoff_ms);
+
+    pthread_mutex_lock(&upstream->lock);
+
+    upstream->requestor = requestor;
+    upstream->backing_off = requestor == NULL;
+    flush_parked(upstream, ECONNREFUSED);
+
+    pthread_mutex_unlock(&upstream->lock);
+
+    if (requestor != NULL) {
+        *backoff_ms = BACKOFF_MIN_MS;
+        return requestor;
+    }
+
+    backoff.tv_sec = *backoff_ms / 1000;
+    backoff.tv_nsec = (long) (*backoff_ms % 1000) * 1000000L;
+    nanosleep(&backoff, NULL);
+
+    if ((*backoff_ms *= 2) > BACKOFF_MAX_MS)
+        *backoff_ms = BACKOFF_MAX_MS;
+
+    pthread_mutex_lock(&upstream->lock);
+    upstream->backing_off = false;
+    pthread_mutex_unlock(&upstream->lock);
+
+    return NULL;
+}
+
+/* Prepends the client's own request ID, if it sent one, to the backend reply */
+static void reply_forward(struct forward *const forward, const rh_server_msg *const reply) {
+    byte framed[RH_FRAME_MAX];
+
+    if (forward->id_size + reply->data_size > sizeof(framed)) {
+        fail_req(forward->msg, forward->id, forward->id_size, EMSGSIZE);
+        forward->msg = NULL;
+        return;
+    }
+
+    memcpy(framed, forward->id, forward->id_size);
+    memcpy(framed + forward->id_size, reply->data, reply->data_size);
+
+    if (rh_send_to_client(forward->msg->return_addr, framed, forward->id_size + reply->data_size)) {
+        metrics_add(METRIC_REQUESTS, 1);
+        metrics_latency(clock_ticks_to_ns(clock_ticks() - forward->msg->received_at));
+    } else
+        metrics_add(METRIC_ERRORS, 1);
+
+    rh_client_msg_destroy(forward->msg, false);
+    forward->msg = NULL;
+}
+
+static __attribute__((noreturn)) void *read_replies(void *const arg) {
+    struct upstream *upstream = arg;
+    struct requestor *requestor = NULL;
+    struct forward forward;
+    rh_server_msg *reply;
+    uint_32 id, backoff_ms = BACKOFF_MIN_MS;
+
+    cpus_pin_all();
+
+    for (;;) {
+        if (requestor == NULL && NULL == (requestor = connect_upstream(upstream, &backoff_ms)))
+            continue;
+
+        if (NULL != (reply = requestor_receive(requestor, &id))) {
+            pthread_mutex_lock(&upstream->lock);
+            forward = upstream->in_flight[id % IN_FLIGHT_MAX];
+
+            if (forward.msg != NULL && forward.upstream_id == id)
+                upstream->in_flight[id % IN_FLIGHT_MAX].msg = NULL;
+            else
+                forward.msg = NULL;
+
+            pthread_mutex_unlock(&upstream->lock);
+
+            if (forward.msg != NULL)
+                reply_forward(&forward, reply);
+
+            rh_server_msg_destroy(reply);
+        } else if (!requestor_is_active(requestor)) {
+            log_error(WARN, errno, "%s: upstream connection lost", upstream->host_addr->service_name);
+
+            /* nothing in flight on it can be answered anymore, the next request reconnects */
+            pthread_mutex_lock(&upstream->lock);
+
+            for (uint_32 i = 0; i < IN_FLIGHT_MAX; ++i) {
+                if (upstream->in_flight[i].msg != NULL)
+                    fail_forward(upstream, &upstream->in_flight[i], ECONNRESET);
+            }
+
+            requestor_destroy(requestor);
+            upstream->requestor = requestor = NULL;
+            pthread_mutex_unlock(&upstream->lock);
+        }
+    }
+}
+
+/* Answers a request whose caller already gave up with a bare error, instead of forwarding it */
+static void shed_req(rh_client_msg *const msg, const usize id_size, const uint_32 id) {
+    struct value error = {0};
+
+    if (id_size > 0)
+        marshall_request_id(id, &error);
+
+    marshall_error(ETIMEDOUT, &error);
+    rh_send_to_client(msg->return_addr, error.value, error.size);
+    marshall_free(&error);
+    rh_client_msg_destroy(msg, false);
+
+    metrics_add(METRIC_SHED, 1);
+}
+
+/* Rewrites the deadline of the request with what is left of it, so that the backend does not count the time it spent
+ * here; false when nothing is */
+static bool pass_deadline(rh_client_msg *const msg, const usize id_size, const uint_32 budget_us) {
+    const uint_64 elapsed_us = clock_ticks_to_ns(clock_ticks() - msg->received_at) / 1000U;
+    struct value deadline = {0};
+
+    if (elapsed_us >= budget_us)
+        return false;
+
+    marshall_deadline((uint_32) (budget_us - elapsed_us), &deadline);
+    memcpy(msg->data + id_size, deadline.value, deadline.size);
+    marshall_free(&deadline);
+
+    return true;
+}
+
+static struct backend *get_backend(struct proxy *const proxy, const char *const service_name) {
+    const struct host_addr *host_addr;
+    struct backend *backend = NULL;
+    pthread_t thread;
+
+    if (!np_lookup(service_name, &host_addr))
+        return NULL;
+
+    pthread_mutex_lock(&proxy->lock);
+
+    for (uint_8 i = 0; i < proxy->backends_count && backend == NULL; ++i) {
+        if (proxy->backends[i].host_addr == host_addr)
+            backend = &proxy->backends[i];
+    }
+
+    if (backend == NULL && proxy->backends_count < BACKENDS_MAX) {
+        backend = &proxy->backends[proxy->backends_count++];
+        backend->host_addr = host_addr;
+        backend->next = 0;
+        backend->upstreams = calloc(proxy->upstreams_num, sizeof(struct upstream));
+
+        for (uint_8 i = 0; i < proxy->upstreams_num; ++i) {
+            backend->upstreams[i].host_addr = host_addr;
+            pthread_mutex_init(&backend->upstreams[i].lock, NULL);
+            pthread_cond_init(&backend->upstreams[i].demand, NULL);
+
+            if ((errno = pthread_create(&thread, NULL, read_replies, &backend->upstreams[i])) != 0)
+                die(EXIT_FAILURE, errno, "Failed to start upstream reader");
+
+            pthread_detach(thread);
+        }
+    }
+
+    pthread_mutex_unlock(&proxy->lock);
+
+    return backend;
+}
+
+static void forward_req(struct proxy *const proxy, rh_client_msg *const msg) {
+    struct value bytes_value = {.type = BYTES, .size = msg->data_size, .value = msg->data};
+    struct backend *backend;
+    struct upstream *upstream;
+    struct forward *forward;
+    struct data *request = NULL;
+    char *service_name = NULL;
+    usize id_size;
+    uint_32 id, budget_us;
+    bool forwarded = false;
+
+    id_size = unmarshall_request_id(&bytes_value, &id);
+
+    if (unmarshall_deadline(&bytes_value, id_size, &budget_us) > 0 && !pass_deadline(msg, id_size, budget_us)) {
+        shed_req(msg, id_size, id);
+        return;
+    }
+
+    /* only the service name is needed to pick a backend, the rest of the frame is forwarded as is */
+    unmarshall(&bytes_value, &service_name, NULL, &request);
+
+    if (request == NULL || service_name == NULL || NULL == (backend = get_backend(proxy, service_name))) {
+        log_debug(DEBUG, NOERR, "%s: no backend for the request", service_name != NULL ? service_name : "?");
+        unmarshall_free(&service_name, NULL, &request);
+        fail_req(msg, msg->data, id_size, EHOSTUNREACH);
+        return;
+    }
+
+    unmarshall_free(&service_name, NULL, &request);
+
+    upstream = &backend->upstreams[__atomic_fetch_add(&backend->next, 1, __ATOMIC_RELAXED) % proxy->upstreams_num];
+
+    pthread_mutex_lock(&upstream->lock);
+
+    if (!upstream->backing_off) {
+        forward = &upstream->in_flight[upstream->next_id % IN_FLIGHT_MAX];
+
+        /* a request still unanswered after IN_FLIGHT_MAX newer ones on the same connection is given up on */
+        if (forward->msg != NULL)
+            fail_forward(upstream, forward, ETIMEDOUT);
+
+        forward->msg = msg;
+        forward->sent = false;
+        forward->upstream_id = upstream->next_id++;
+        forward->id_size = id_size;
+        memcpy(forward->id, msg->data, id_size);
+        ++upstream->parked;
+
+        /* without a connection, the request waits for the reader thread to make one */
+        if (upstream->requestor == NULL) {
+            forwarded = true;
+            pthread_cond_signal(&upstream->demand);
+        } else if (!(forwarded = send_forward(upstream, forward))) {
+            forward->msg = NULL;
+            --upstream->parked;
+        }
+    } else
+        errno = ECONNREFUSED;
+
+    pthread_mutex_unlock(&upstream->lock);
+
+    if (!forwarded) {
+        log_error(DEBUG, errno, "%s: failed to forward request", backend->host_addr->service_name);
+        fail_req(msg, msg->data, id_size, ECONNREFUSED);
+    }
+}
+
+static __attribute__((noreturn)) void *run_reactor(void *const arg) {
+    struct proxy *proxy = arg;
+    rh_server_ctx *server_ctx;
+    rh_client_msg *msg;
+
+    cpus_pin_next();
+
+    if (NULL == (server_ctx = rh_server_new(proxy->protocol, proxy->port, proxy->path)))
+        die(EXIT_FAILURE, errno, "Failed to start proxy");
+    else
+        log_print(INFO, "Proxy is running");
+
+    for (;; errno = 0) {
+        if (NULL != (msg = rh_receive_from_client(server_ctx)))
+            forward_req(proxy, msg);
+    }
+}
+
+void run_proxy(const enum protocol protocol, const uint_16 port, const char *const path, const uint_8 thread_num,
+               const uint_8 upstreams_num) {
+    struct proxy *proxy = calloc(1, sizeof(struct proxy));
+    pthread_t thread;
+
+    proxy->protocol = protocol;
+    proxy->port = port;
+    proxy->path = path;
+    proxy->upstreams_num = upstreams_num;
+    pthread_mutex_init(&proxy->lock, NULL);
+
+    for (uint_8 i = 1; i < thread_num; ++i) {
+        if ((errno = pthread_create(&thread, NULL, run_reactor, proxy)) != 0)
+            die(EXIT_FAILURE, errno, "Failed to start proxy");
+
+        pthread_detach(thread);
+    }
+
+    run_reactor(proxy);
+}
@@ -0,0 +1,11 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_PROXY_H
+#define CSOCKET_PROXY_H
+
+#include "types/primitive.h"
+#include "rh/types.h"
+
+__attribute__((noreturn)) void run_proxy(enum protocol protocol, uint_16 port, const char *path, uint_8 thread_num,
+                                        uint_8 upstreams_num);
+
+#endif /* CSOCKET_PROXY_H */
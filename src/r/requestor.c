@@ -2,14 +2,15 @@
 #include "requestor.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include "log.h"
-#include "rh/client.h"
 #include "m/marshaller.h"
 
 struct requestor {
     const struct host_addr *host_addr;
     bool closed;
+    uint_32 deadline_us;
     rh_conn_ctx *conn_ctx;
 };
 
@@ -25,6 +26,7 @@ struct requestor *requestor_new(const struct host_addr *const host_addr) {
     requestor->host_addr = host_addr;
     requestor->conn_ctx = conn_ctx;
     requestor->closed = false;
+    requestor->deadline_us = RH_TIMEOUT_MS * 1000U;
 
     return requestor;
 }
@@ -38,9 +40,17 @@ bool requestor_is_active(struct requestor *requestor) {
     return !requestor->closed;
 }
 
+void requestor_set_deadline(struct requestor *const requestor, const uint_32 budget_us) {
+    requestor->deadline_us = budget_us;
+}
+
 bool requestor_invoke(struct requestor *requestor, const char *const method, const struct data *const request, struct data **const reply) {
     struct value bytes_value = {0};
     rh_server_msg *msg;
+    uint_8 error;
+
+    if (requestor->deadline_us > 0)
+        marshall_deadline(requestor->deadline_us, &bytes_value);
 
     marshall(request, requestor->host_addr->service_name, method, &bytes_value);
 
@@ -56,14 +66,18 @@ bool requestor_invoke(struct requestor *requestor, const char *const method, con
             bytes_value.size = msg->data_size;
             bytes_value.value = msg->data;
 
-            unmarshall(&bytes_value, NULL, NULL, reply);
+            *reply = NULL;
+
+            if (0 == (error = unmarshall_error(&bytes_value, 0)))
+                unmarshall(&bytes_value, NULL, NULL, reply);
 
             rh_server_msg_destroy(msg);
 
             if (*reply)
                 return true;
-            else
-                errno = ENOMSG;
+
+            /* a server that gave up on the request says so, anything else is a reply this could not make sense of */
+            errno = error == ETIMEDOUT ? ETIMEDOUT : ENOMSG;
         } else {
             requestor->closed = true;
             log_debug(DEBUG, errno, "Failed to receive message from server");
@@ -77,3 +91,61 @@ bool requestor_invoke(struct requestor *requestor, const char *const method, con
 
     return false;
 }
+
+bool requestor_send(struct requestor *const requestor, const uint_32 id, const byte *const frame, const usize size) {
+    struct value bytes_value = {0};
+
+    marshall_request_id(id, &bytes_value);
+    bytes_value.value = realloc(bytes_value.value, bytes_value.size + size);
+    memcpy((byte *) bytes_value.value + bytes_value.size, frame, size);
+    bytes_value.size += size;
+
+    if (!rh_send_to_server(requestor->conn_ctx, bytes_value.value, bytes_value.size)) {
+        requestor->closed = true;
+        free(bytes_value.value);
+
+        log_debug(DEBUG, errno, "Failed to send message to server");
+        return false;
+    }
+
+    log_print(NOISY, "Sent message %u with %ld bytes to server", id, bytes_value.size);
+    free(bytes_value.value);
+
+    return true;
+}
+
+rh_server_msg *requestor_receive(struct requestor *const requestor, uint_32 *const id) {
+    struct value bytes_value = {0};
+    rh_server_msg *msg;
+    usize id_size;
+
+    if (NULL == (msg = rh_receive_from_server(requestor->conn_ctx))) {
+        /* the receive timeout only means nothing was in flight */
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            requestor->closed = true;
+            log_debug(DEBUG, errno, "Failed to receive message from server");
+        }
+
+        return NULL;
+    }
+
+    bytes_value.type = BYTES;
+    bytes_value.size = msg->data_size;
+    bytes_value.value = msg->data;
+
+    /* a reply that does not lead with its request ID cannot be routed, and neither can anything after it */
+    if (0 == (id_size = unmarshall_request_id(&bytes_value, id))) {
+        requestor->closed = true;
+        rh_server_msg_destroy(msg);
+
+        errno = ENOMSG;
+        return NULL;
+    }
+
+    msg->data_size -= id_size;
+    memmove(msg->data, msg->data + id_size, msg->data_size);
+
+    log_print(NOISY, "Received message %u with %ld bytes from server", *id, msg->data_size);
+
+    return msg;
+}
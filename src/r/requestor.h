@@ -5,6 +5,7 @@
 #include "np/types.h"
 #include "m/data.h"
 #include "rh/types.h"
+#include "rh/client.h"
 
 struct requestor;
 
@@ -14,6 +15,16 @@ void requestor_destroy(struct requestor *);
 
 bool requestor_is_active(struct requestor *);
 
+/* Requests carry the time left to answer them, RH_TIMEOUT_MS unless set otherwise, 0 leaves it out */
+void requestor_set_deadline(struct requestor *, uint_32 budget_us);
+
+/* Fails with ETIMEDOUT when the server shed the request past its deadline, with ENOMSG when the reply made no sense */
 bool requestor_invoke(struct requestor *, const char *method, const struct data *request, struct data **reply);
 
+/* Multiplexed use: frames already marshalled are tagged with an ID and their replies may come back in any order, so one
+ * thread can keep sending while another receives */
+bool requestor_send(struct requestor *, uint_32 id, const byte *frame, usize size);
+
+rh_server_msg *requestor_receive(struct requestor *, uint_32 *id);
+
 #endif /* CSOCKET_REQUESTOR_H */
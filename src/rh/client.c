@@ -5,20 +5,101 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "shm.h"
+#include "co/coroutine.h"
 
-#define BUFFER_SIZE 512
+#define BUFFER_SIZE RH_FRAME_MAX
 
 struct rh_conn_ctx {
     enum protocol protocol;
     int socket_fd;
+    uint_16 buffered;
+    byte buffer[RH_FRAME_HEADER + RH_FRAME_MAX];
+    struct shm_channel *shm;
 };
 
-rh_conn_ctx *rh_client_new(const enum protocol protocol, const char *host, const uint_16 port) {
+/* Connects without blocking the thread, so other coroutines run while the handshake is in progress */
+static bool connect_yielding(const int socket_fd, const struct addrinfo *const host_addr) {
+    const int flags = fcntl(socket_fd, F_GETFL);
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+
+    fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(socket_fd, host_addr->ai_addr, host_addr->ai_addrlen) < 0) {
+        if (errno != EINPROGRESS || !coroutine_wait(socket_fd, POLLOUT, RH_TIMEOUT_MS))
+            return false;
+
+        getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    }
+
+    fcntl(socket_fd, F_SETFL, flags);
+    errno = err;
+
+    return err == 0;
+}
+
+static rh_conn_ctx *conn_new(const enum protocol protocol, const int socket_fd) {
+    rh_conn_ctx *conn_ctx = malloc(sizeof(rh_conn_ctx));
+
+    conn_ctx->protocol = protocol;
+    conn_ctx->socket_fd = socket_fd;
+    conn_ctx->buffered = 0;
+    conn_ctx->shm = NULL;
+
+    return conn_ctx;
+}
+
+/* A local peer is addressed by the path its server listens on, resolving it takes no lookup */
+static rh_conn_ctx *unix_connect(const enum protocol protocol, const char *const path, const struct timeval *const time) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    struct addrinfo host_addr = {.ai_addr = (struct sockaddr *) &address, .ai_addrlen = sizeof(address)};
+    struct shm_channel *shm = NULL;
     rh_conn_ctx *conn_ctx;
+    int fds[SHM_FDS];
+    int_32 socket_fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    strcpy(address.sun_path, path);
+
+    if ((socket_fd = socket(AF_UNIX, protocol == SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM, PF_UNSPEC)) < 0)
+        return NULL;
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, time, sizeof(*time)) < 0 ||
+        (coroutine_active() ? !connect_yielding(socket_fd, &host_addr) : connect(socket_fd, host_addr.ai_addr, host_addr.ai_addrlen) < 0)) {
+        close(socket_fd);
+        return NULL;
+    }
+
+    /* the server maps the same rings from the descriptors, the socket then only tells either side the other is gone */
+    if (protocol == SHM && (NULL == (shm = shm_channel_new(fds)) || !shm_send_fds(socket_fd, fds))) {
+        if (shm != NULL)
+            shm_channel_destroy(shm);
+
+        close(socket_fd);
+        return NULL;
+    }
+
+    conn_ctx = conn_new(protocol, socket_fd);
+    conn_ctx->shm = shm;
+
+    return conn_ctx;
+}
+
+rh_conn_ctx *rh_client_new(const enum protocol protocol, const char *host, const uint_16 port) {
     int_32 socket_fd;
     char service_port[6] = {0};
     int err;
@@ -28,10 +109,13 @@ rh_conn_ctx *rh_client_new(const enum protocol protocol, const char *host, const
             .ai_protocol = PF_UNSPEC
     };
     struct timeval time = {
-            .tv_sec = 5,
+            .tv_sec = RH_TIMEOUT_MS / 1000,
             .tv_usec = 0
     };
 
+    if (RH_LOCAL(protocol))
+        return unix_connect(protocol, host, &time);
+
     if (sprintf(service_port, "%d", port) < 1) {
         errno = EINVAL;
         return NULL;
@@ -73,28 +157,31 @@ rh_conn_ctx *rh_client_new(const enum protocol protocol, const char *host, const
         return NULL;
     }
 
-    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time)) < 0) {
-        freeaddrinfo(host_addr);
-        return NULL;
-    }
-
-    if (connect(socket_fd, host_addr->ai_addr, host_addr->ai_addrlen) < 0) {
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time)) < 0 ||
+        (coroutine_active() ? !connect_yielding(socket_fd, host_addr) : connect(socket_fd, host_addr->ai_addr, host_addr->ai_addrlen) < 0)) {
+        close(socket_fd);
         freeaddrinfo(host_addr);
         return NULL;
     }
 
     freeaddrinfo(host_addr);
 
-    conn_ctx = malloc(sizeof(rh_conn_ctx));
-    conn_ctx->protocol = protocol;
-    conn_ctx->socket_fd = socket_fd;
-
-    return conn_ctx;
+    return conn_new(protocol, socket_fd);
 }
 
 bool rh_send_to_server(rh_conn_ctx *const conn_ctx, const byte *const data, const usize data_size) {
-    if (conn_ctx->protocol == TCP) {
-        if (write(conn_ctx->socket_fd, data, data_size) != (ssize) data_size)
+    if (conn_ctx->shm != NULL) {
+        return shm_push(conn_ctx->shm, SHM_REQUESTS, data, data_size);
+    } else if (RH_FRAMED(conn_ctx->protocol)) {
+        byte header[RH_FRAME_HEADER] = {(byte) (data_size >> 8U), (byte) data_size};
+        struct iovec iov[2] = {{header, RH_FRAME_HEADER}, {(void *) data, data_size}};
+
+        if (data_size > RH_FRAME_MAX) {
+            errno = EMSGSIZE;
+            return false;
+        }
+
+        if (writev(conn_ctx->socket_fd, iov, 2) != (ssize) (RH_FRAME_HEADER + data_size))
             return false;
         else
             return true;
@@ -106,15 +193,82 @@ bool rh_send_to_server(rh_conn_ctx *const conn_ctx, const byte *const data, cons
     }
 }
 
+/* Replies to pipelined requests may arrive in one segment, so whatever follows the first frame stays buffered */
+static ssize read_frame(rh_conn_ctx *const conn_ctx, byte *const data) {
+    ssize data_size;
+    uint_16 size;
+
+    for (;;) {
+        if (conn_ctx->buffered >= RH_FRAME_HEADER) {
+            size = (uint_16) (conn_ctx->buffer[0] << 8U | conn_ctx->buffer[1]);
+
+            if (size == 0 || size > RH_FRAME_MAX) {
+                errno = EMSGSIZE;
+                return -1;
+            }
+
+            if (conn_ctx->buffered >= RH_FRAME_HEADER + size) {
+                memcpy(data, conn_ctx->buffer + RH_FRAME_HEADER, size);
+                conn_ctx->buffered = (uint_16) (conn_ctx->buffered - RH_FRAME_HEADER - size);
+                memmove(conn_ctx->buffer, conn_ctx->buffer + RH_FRAME_HEADER + size, conn_ctx->buffered);
+
+                return size;
+            }
+        }
+
+        /* a coroutine gives its thread up until the reply arrives instead of blocking in read() */
+        if (coroutine_active() && !coroutine_wait(conn_ctx->socket_fd, POLLIN, RH_TIMEOUT_MS))
+            return -1;
+
+        if ((data_size = read(conn_ctx->socket_fd, conn_ctx->buffer + conn_ctx->buffered,
+                              sizeof(conn_ctx->buffer) - conn_ctx->buffered)) <= 0)
+            return data_size;
+
+        conn_ctx->buffered = (uint_16) (conn_ctx->buffered + data_size);
+    }
+}
+
+/* Spins on the reply ring first, a caller waiting for a reply it just asked for usually gets it without a syscall */
+static ssize read_shm(rh_conn_ctx *const conn_ctx, byte *const data) {
+    const int wakeup_fd = shm_wakeup_fd(conn_ctx->shm, SHM_REPLIES);
+    struct pollfd fds[2] = {{.fd = wakeup_fd, .events = POLLIN}, {.fd = conn_ctx->socket_fd, .events = POLLIN}};
+    ssize data_size;
+    bool woken;
+
+    while (0 == (data_size = (ssize) shm_pop(conn_ctx->shm, SHM_REPLIES, data))) {
+        if (shm_spin(conn_ctx->shm, SHM_REPLIES) || !shm_sleep(conn_ctx->shm, SHM_REPLIES))
+            continue;
+
+        if (coroutine_active())
+            woken = coroutine_wait(wakeup_fd, POLLIN, RH_TIMEOUT_MS);
+        else
+            woken = poll(fds, 2, RH_TIMEOUT_MS) > 0 && !(fds[1].revents & (POLLIN | POLLHUP | POLLERR));
+
+        shm_wake(conn_ctx->shm, SHM_REPLIES, woken);
+
+        /* the socket only becomes readable when the server closes it */
+        if (!woken && !shm_ready(conn_ctx->shm, SHM_REPLIES)) {
+            if (fds[1].revents == 0)
+                errno = EAGAIN;
+
+            return fds[1].revents == 0 ? -1 : 0;
+        }
+    }
+
+    return data_size;
+}
+
 rh_server_msg *rh_receive_from_server(rh_conn_ctx *const conn_ctx) {
     rh_server_msg *server_msg = malloc(sizeof(rh_server_msg));
     ssize data_size = -1;
 
     server_msg->data = malloc(BUFFER_SIZE);
 
-    if (conn_ctx->protocol == TCP) {
-        data_size = read(conn_ctx->socket_fd, server_msg->data, BUFFER_SIZE);
-    } else {
+    if (conn_ctx->shm != NULL) {
+        data_size = read_shm(conn_ctx, server_msg->data);
+    } else if (RH_FRAMED(conn_ctx->protocol)) {
+        data_size = read_frame(conn_ctx, server_msg->data);
+    } else if (!coroutine_active() || coroutine_wait(conn_ctx->socket_fd, POLLIN, RH_TIMEOUT_MS)) {
         data_size = recvfrom(conn_ctx->socket_fd, server_msg->data, BUFFER_SIZE, 0, NULL, NULL);
     }
 
@@ -139,6 +293,9 @@ void rh_server_msg_destroy(rh_server_msg *server_msg) {
 }
 
 void rh_client_destroy(rh_conn_ctx *conn_ctx) {
+    if (conn_ctx->shm != NULL)
+        shm_channel_destroy(conn_ctx->shm);
+
     close(conn_ctx->socket_fd);
     free(conn_ctx);
 }
@@ -0,0 +1,129 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _GNU_SOURCE
+
+#include "cpu.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "log.h"
+
+static uint_16 cpus[CPUS_MAX];
+static uint_16 cpus_num = 0;
+static uint_16 cpus_next = 0;
+static bool cpus_partitioned = false;
+
+bool cpus_parse(const char *list) {
+    uint_16 count = 0;
+    long first, last;
+    char *endptr;
+
+    do {
+        first = last = strtol(list, &endptr, 10);
+
+        if (endptr == list || first < 0 || first >= CPUS_MAX)
+            return false;
+
+        if (*endptr == '-') {
+            list = endptr + 1;
+            last = strtol(list, &endptr, 10);
+
+            if (endptr == list || last < first || last >= CPUS_MAX)
+                return false;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu) {
+            if (count == CPUS_MAX)
+                return false;
+
+            cpus[count++] = (uint_16) cpu;
+        }
+
+        list = endptr + 1;
+    } while (*endptr == ',');
+
+    if (*endptr != '\0')
+        return false;
+
+    cpus_num = count;
+
+    return true;
+}
+
+void cpus_partition(const uint_16 part, const uint_16 parts) {
+    uint_16 first, count;
+
+    if (cpus_num == 0 || parts <= 1)
+        return;
+
+    if (cpus_num < parts) {
+        first = part % cpus_num;
+        count = 1;
+    } else {
+        first = (uint_16) (part * (cpus_num / parts) + (part < cpus_num % parts ? part : cpus_num % parts));
+        count = (uint_16) (cpus_num / parts + (part < cpus_num % parts));
+    }
+
+    for (uint_16 i = 0; i < count; ++i)
+        cpus[i] = cpus[first + i];
+
+    cpus_num = count;
+    cpus_partitioned = true;
+}
+
+bool cpus_steering(void) {
+    return cpus_num > 0 && !cpus_partitioned;
+}
+
+static bool pin(const cpu_set_t *const set) {
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set)) != 0) {
+        log_error(WARN, errno, "Failed to set the CPU affinity");
+        return false;
+    }
+
+    return true;
+}
+
+int cpus_pin_next(void) {
+    cpu_set_t set;
+    uint_16 cpu;
+
+    if (cpus_num == 0)
+        return -1;
+
+    cpu = cpus[__atomic_fetch_add(&cpus_next, 1, __ATOMIC_RELAXED) % cpus_num];
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pin(&set) ? cpu : -1;
+}
+
+bool cpus_pin_all(void) {
+    cpu_set_t set;
+
+    if (cpus_num == 0)
+        return false;
+
+    CPU_ZERO(&set);
+
+    for (uint_16 i = 0; i < cpus_num; ++i)
+        CPU_SET(cpus[i], &set);
+
+    return pin(&set);
+}
+
+int cpus_pinned(void) {
+    cpu_set_t set;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0 || CPU_COUNT(&set) != 1)
+        return -1;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set))
+            return cpu;
+    }
+
+    return -1;
+}
@@ -0,0 +1,32 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_RH_CPU_H
+#define CSOCKET_RH_CPU_H
+
+#include "types/primitive.h"
+
+/* The CPUs the process may run on, when given: each reactor is pinned to one of them, in turn, and the threads that serve
+ * all the reactors to the whole list. A thread pinned before it allocates keeps its buffers, and its malloc arena, on the
+ * NUMA node of its CPU, since the kernel places pages on the node of the CPU that first touches them */
+#define CPUS_MAX 1024
+
+/* Takes a list such as "0-3,8,10-11" */
+bool cpus_parse(const char *list);
+
+/* Keeps the part-th of parts contiguous slices of the list, so that each process sharing a port runs on CPUs of its own,
+ * and likely of its own NUMA node; a list shorter than parts is shared instead, a CPU for each process in turn */
+void cpus_partition(uint_16 part, uint_16 parts);
+
+/* Whether the listeners may steer requests to the CPU of their reactor, which needs a list that no other process shares
+ * the port with */
+bool cpus_steering(void);
+
+/* Pins the calling thread to the next CPU of the list, returning it, or -1 when there is no list or it failed */
+int cpus_pin_next(void);
+
+/* Pins the calling thread to every CPU of the list, if any */
+bool cpus_pin_all(void);
+
+/* The only CPU the calling thread may run on, -1 when it may run on several */
+int cpus_pinned(void);
+
+#endif /* CSOCKET_RH_CPU_H */
@@ -2,143 +2,945 @@
 #include "server.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <asm/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
 #include <errno.h>
+#include "cpu.h"
+#include "shm.h"
+#include "timer.h"
 #include "log.h"
+#include "stats/clock.h"
+#include "stats/trace.h"
+#include "stats/metrics.h"
 
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE RH_FRAME_MAX
+#define LISTENERS_MAX 8
+#define REUSEPORT_MAX 256
+#define IOV_BATCH 64
+#define SLAB_CLIENTS 64
+#define CLIENT_NONE UINT16_MAX
+#define SLABS_MAX ((CLIENT_NONE + SLAB_CLIENTS - 1) / SLAB_CLIENTS)
+#define SHM_HANDSHAKE_NS 1000000000U
+#define OUTPUT_MAX (64U * (RH_FRAME_HEADER + RH_FRAME_MAX))
 
+/* A connection handle is its slot position in the low half and the slot generation in the high one: the generation
+ * changes every time the slot is freed, so a handle held past the end of its connection finds nothing */
+#define CLIENT_HANDLE(client) ((uint_32) (client)->generation << 16U | (client)->pos)
+
+/* A reply posted by another thread to the reactor that owns its connection, with the frame header in front of it */
+struct reply {
+    struct reply *next;
+    uint_32 client_handle;
+    uint_16 size;
+    byte frame[];
+};
+
+/* Clients live in fixed slabs of SLAB_CLIENTS slots that are never moved nor freed: a closed client's slot, with fd -1,
+ * goes to the free list and is handed out again to the next connection. The count of requests in flight is the only
+ * field other threads write, along with the generation it counts for so that a late release misses a reused slot.
+ * Sockets do not block: the replies a client is not reading yet wait in its output, up to OUTPUT_MAX bytes */
 struct client {
     int fd;
     uint_16 pos;
+    uint_16 generation;
+    uint_16 next_free;
+    bool paused;
+    uint_64 in_flight;
+    struct sockaddr_in address;
+    uint_16 buffered;
+    byte buffer[RH_FRAME_HEADER + RH_FRAME_MAX];
+    struct shm_channel *shm;
+    struct timer idle;
+    uint_64 active_at;
+    struct reply *output;
+    struct reply *output_tail;
+    uint_16 output_offset;
+    usize output_size;
 };
 
+/* Only the reactor thread receiving from it touches the clients: other threads post their replies, or a reply of size 0
+ * to close a connection, to its mailbox. The mailbox is a lock-free stack the reactor takes whole, and its eventfd is
+ * only written when the reactor is asleep in select() */
 struct rh_server_ctx {
     enum protocol protocol;
     int server_fd;
-    uint_16 clients_capacity;
+    uint_16 slabs_count;
     uint_16 clients_count;
-    struct client **clients;
+    uint_16 free_head;
+    uint_16 paused_count;
+    struct client *slabs[SLABS_MAX];
+    struct client *pending;
+    uint_16 shm_next;
+    pthread_t owner;
+    int wakeup_fd;
+    uint_32 asleep;
+    struct reply *mailbox;
+    struct timer_wheel *timers;
+    uint_64 idle_timeout_ns;
+    uint_32 in_flight_limit;
 };
 
+static uint_64 idle_timeout_ns = 0;
+static uint_32 in_flight_limit = 0;
+
 struct rh_client_addr {
     const rh_server_ctx *server_ctx;
     struct sockaddr_in client_address;
-    uint_16 client_pos;
+    uint_32 client_handle;
+    bool in_flight;
 };
 
-rh_server_ctx *rh_server_new(const enum protocol protocol, const uint_16 port_to_listen) {
-    rh_server_ctx *server_ctx;
-    int_32 server_fd, optval = 1;
+/* A path can only be bound once, so every reactor of the process shares its listener: it does not block on accept(),
+ * the reactors woken up for a connection that another one took just go back to select() */
+static int unix_listen(const enum protocol protocol, const char *const path) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static struct {
+        char path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+        int fd;
+    } listeners[LISTENERS_MAX];
+    static uint_8 listeners_count = 0;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int server_fd = -1;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(address.sun_path, path);
+    pthread_mutex_lock(&lock);
+
+    for (uint_8 i = 0; i < listeners_count && server_fd < 0; ++i) {
+        if (strcmp(listeners[i].path, path) == 0)
+            server_fd = listeners[i].fd;
+    }
+
+    if (server_fd < 0 && listeners_count < LISTENERS_MAX) {
+        unlink(path);
+
+        if ((server_fd = socket(AF_UNIX, protocol == SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM, PF_UNSPEC)) >= 0 &&
+            (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(server_fd, 16) < 0 ||
+             fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK) < 0)) {
+            close(server_fd);
+            server_fd = -1;
+        } else if (server_fd >= 0) {
+            strcpy(listeners[listeners_count].path, path);
+            listeners[listeners_count++].fd = server_fd;
+        }
+    } else if (server_fd < 0)
+        errno = EMFILE;
+
+    pthread_mutex_unlock(&lock);
+
+    return server_fd;
+}
+
+/* A listener of a SO_REUSEPORT group and the CPU its reactor is pinned to, -1 when it is not: the kernel numbers the
+ * listeners of a group in the order they join it */
+struct reuseport_group {
+    enum protocol protocol;
+    uint_16 port;
+    uint_16 count;
+    int_32 cpus[REUSEPORT_MAX];
+};
+
+/* Hands a packet, or a connection, to the listener whose reactor is pinned to the CPU that received it, that is the CPU
+ * of its RX queue; a CPU with no listener of its own, or with several, is left to the kernel hash */
+static void reuseport_steer(const int server_fd, const struct reuseport_group *const group) {
+    struct sock_filter code[2 + REUSEPORT_MAX * 2];
+    struct sock_fprog program = {.len = 0, .filter = code};
+    uint_16 shared;
+
+    code[program.len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint_32) (SKF_AD_OFF + SKF_AD_CPU));
+
+    for (uint_16 i = 0; i < group->count; ++i) {
+        shared = 0;
+
+        for (uint_16 j = 0; j < group->count; ++j)
+            shared += group->cpus[j] == group->cpus[i];
+
+        if (group->cpus[i] < 0 || shared > 1)
+            continue;
+
+        code[program.len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint_32) group->cpus[i], 0, 1);
+        code[program.len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, i);
+    }
+
+    code[program.len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, UINT32_MAX);
+
+    if (setsockopt(server_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+        log_error(WARN, errno, "Failed to attach the reuseport steering program");
+}
+
+/* Every reactor of a TCP or UDP port has a listener of its own in the same SO_REUSEPORT group: when its thread is pinned
+ * to a CPU, the listener prefers the requests received there */
+static int inet_listen(const enum protocol protocol, const uint_16 port) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static struct reuseport_group groups[LISTENERS_MAX];
+    static uint_8 groups_count = 0;
     struct sockaddr_in address = {
             .sin_family = AF_INET,
             .sin_addr = {.s_addr = htonl(INADDR_ANY)},
-            .sin_port = htons(port_to_listen)
+            .sin_port = htons(port)
     };
+    struct reuseport_group *group = NULL;
+    const int_32 cpu = cpus_pinned();
+    int_32 server_fd, optval = 1;
 
     if ((server_fd = socket(AF_INET, protocol == TCP ? SOCK_STREAM : SOCK_DGRAM, PF_UNSPEC)) < 0)
-        return NULL;
+        return -1;
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0)
-        return NULL;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0 ||
+        (cpu >= 0 && setsockopt(server_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)) {
+        close(server_fd);
+        return -1;
+    }
 
-    if (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0)
-        return NULL;
+    /* the listeners join the group on bind() for UDP and listen() for TCP, one at a time so that their numbers are known */
+    pthread_mutex_lock(&lock);
 
-    if (protocol == TCP && listen(server_fd, 16) < 0)
+    if (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || (protocol == TCP && listen(server_fd, 16) < 0)) {
+        pthread_mutex_unlock(&lock);
+        close(server_fd);
+        return -1;
+    }
+
+    for (uint_8 i = 0; i < groups_count && group == NULL; ++i) {
+        if (groups[i].protocol == protocol && groups[i].port == port)
+            group = &groups[i];
+    }
+
+    if (group == NULL && groups_count < LISTENERS_MAX) {
+        group = &groups[groups_count++];
+        group->protocol = protocol;
+        group->port = port;
+        group->count = 0;
+    }
+
+    if (group != NULL && group->count < REUSEPORT_MAX) {
+        group->cpus[group->count++] = cpu;
+
+        /* the program is the group's, replaced by each listener as it knows of one more */
+        if (cpus_steering())
+            reuseport_steer(server_fd, group);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return server_fd;
+}
+
+bool rh_server_share(const enum protocol protocol, const char *const path) {
+    return !RH_LOCAL(protocol) || unix_listen(protocol, path) >= 0;
+}
+
+rh_server_ctx *rh_server_new(const enum protocol protocol, const uint_16 port_to_listen, const char *const path) {
+    rh_server_ctx *server_ctx;
+    int_32 server_fd;
+
+    if (RH_LOCAL(protocol)) {
+        if ((server_fd = unix_listen(protocol, path)) < 0)
+            return NULL;
+    } else if ((server_fd = inet_listen(protocol, port_to_listen)) < 0)
         return NULL;
 
     server_ctx = malloc(sizeof(rh_server_ctx));
     server_ctx->protocol = protocol;
     server_ctx->server_fd = server_fd;
-    server_ctx->clients_capacity = 10;
+    server_ctx->slabs_count = 0;
     server_ctx->clients_count = 0;
-    server_ctx->clients = malloc(sizeof(struct client *) * server_ctx->clients_capacity);
+    server_ctx->free_head = CLIENT_NONE;
+    server_ctx->paused_count = 0;
+    server_ctx->pending = NULL;
+    server_ctx->shm_next = 0;
+    server_ctx->owner = pthread_self();
+    server_ctx->wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    server_ctx->asleep = 0;
+    server_ctx->mailbox = NULL;
+    server_ctx->timers = timer_wheel_new(clock_now_ns());
+    server_ctx->idle_timeout_ns = idle_timeout_ns;
+    server_ctx->in_flight_limit = in_flight_limit;
 
     return server_ctx;
 }
 
-static int build_fd_set(const rh_server_ctx *const server_ctx, fd_set *const read_fds) {
-    int n_fds = server_ctx->server_fd;
+void rh_server_set_idle_timeout(const uint_32 seconds) {
+    idle_timeout_ns = (uint_64) seconds * 1000000000U;
+}
+
+void rh_server_set_in_flight_limit(const uint_32 requests) {
+    in_flight_limit = requests;
+}
+
+/* The client in slot pos, NULL if the slot is free */
+static struct client *client_at(const rh_server_ctx *const server_ctx, const uint_16 pos) {
+    struct client *client = &server_ctx->slabs[pos / SLAB_CLIENTS][pos % SLAB_CLIENTS];
+
+    return client->fd >= 0 ? client : NULL;
+}
+
+static struct client *client_get(const rh_server_ctx *const server_ctx, const uint_32 handle) {
+    const uint_16 pos = (uint_16) handle;
+    struct client *client;
+
+    if (pos >= server_ctx->clients_count || NULL == (client = client_at(server_ctx, pos)) || CLIENT_HANDLE(client) != handle)
+        return NULL;
+
+    return client;
+}
+
+/* Takes a slot off the free list, or the next one of the last slab, adding a slab when it is full */
+static struct client *client_alloc(rh_server_ctx *const server_ctx) {
+    struct client *client;
+
+    if (server_ctx->free_head != CLIENT_NONE) {
+        client = &server_ctx->slabs[server_ctx->free_head / SLAB_CLIENTS][server_ctx->free_head % SLAB_CLIENTS];
+        server_ctx->free_head = client->next_free;
+
+        return client;
+    }
+
+    if (server_ctx->clients_count == CLIENT_NONE) {
+        errno = EMFILE;
+        return NULL;
+    }
+
+    /* the release of a request may look the slab up from another thread at any time, so it is published last */
+    if (server_ctx->clients_count == server_ctx->slabs_count * SLAB_CLIENTS)
+        __atomic_store_n(&server_ctx->slabs[server_ctx->slabs_count++], malloc(sizeof(struct client) * SLAB_CLIENTS),
+                         __ATOMIC_RELEASE);
+
+    client = &server_ctx->slabs[server_ctx->clients_count / SLAB_CLIENTS][server_ctx->clients_count % SLAB_CLIENTS];
+    client->pos = server_ctx->clients_count++;
+    client->generation = 0;
+    client->paused = false;
+    __atomic_store_n(&client->in_flight, 0, __ATOMIC_RELAXED);
+
+    return client;
+}
+
+static void client_free(rh_server_ctx *const server_ctx, struct client *const client) {
+    client->fd = -1;
+    ++client->generation;
+    __atomic_store_n(&client->in_flight, (uint_64) client->generation << 32U, __ATOMIC_SEQ_CST);
+    client->next_free = server_ctx->free_head;
+    server_ctx->free_head = client->pos;
+
+    if (client->paused) {
+        client->paused = false;
+        --server_ctx->paused_count;
+    }
+}
+
+static int build_fd_set(const rh_server_ctx *const server_ctx, fd_set *const read_fds, fd_set *const write_fds) {
+    int n_fds = server_ctx->server_fd > server_ctx->wakeup_fd ? server_ctx->server_fd : server_ctx->wakeup_fd;
     FD_ZERO(read_fds);
+    FD_ZERO(write_fds);
     FD_SET(server_ctx->server_fd, read_fds);  /* NOLINT(hicpp-signed-bitwise) */
+    FD_SET(server_ctx->wakeup_fd, read_fds);  /* NOLINT(hicpp-signed-bitwise) */
 
     for (uint_16 i = 0; i < server_ctx->clients_count; ++i) {
-        if (server_ctx->clients[i] != NULL) {
-            FD_SET(server_ctx->clients[i]->fd, read_fds);  /* NOLINT(hicpp-signed-bitwise) */
+        const struct client *client = client_at(server_ctx, i);
+
+        if (client != NULL && client->output != NULL) {
+            FD_SET(client->fd, write_fds);  /* NOLINT(hicpp-signed-bitwise) */
+
+            if (client->fd > n_fds)
+                n_fds = client->fd;
+        }
+
+        if (client != NULL && !client->paused) {
+            FD_SET(client->fd, read_fds);  /* NOLINT(hicpp-signed-bitwise) */
+
+            if (client->fd > n_fds)
+                n_fds = client->fd;
+
+            if (client->shm != NULL) {
+                const int wakeup_fd = shm_wakeup_fd(client->shm, SHM_REQUESTS);
+
+                FD_SET(wakeup_fd, read_fds);  /* NOLINT(hicpp-signed-bitwise) */
 
-            if (server_ctx->clients[i]->fd > n_fds)
-                n_fds = server_ctx->clients[i]->fd;
+                if (wakeup_fd > n_fds)
+                    n_fds = wakeup_fd;
+            }
         }
     }
 
     return n_fds + 1;
 }
 
+static void close_client(rh_server_ctx *const server_ctx, struct client *const client) {
+    shutdown(client->fd, SHUT_WR);
+
+    /* whatever is left unread is discarded, the client buffer is no longer needed; a peer that goes on sending, or
+     * just keeps its end open, is not waited for */
+    while (recv(client->fd, client->buffer, sizeof(client->buffer), MSG_DONTWAIT) > 0)
+        continue;
+
+    close(client->fd);
+    timer_cancel(server_ctx->timers, &client->idle);
+
+    for (struct reply *next; client->output != NULL; client->output = next) {
+        next = client->output->next;
+        free(client->output);
+    }
+
+    if (client->shm != NULL)
+        shm_channel_destroy(client->shm);
+
+    if (server_ctx->pending == client)
+        server_ctx->pending = NULL;
+
+    client_free(server_ctx, client);
+
+    metrics_add(METRIC_CONNECTIONS_CLOSED, 1);
+}
+
+/* Requests and replies only record when they happened, the timer is moved when it fires early */
+static void idle_expired(struct timer *const timer, void *const arg) {
+    rh_server_ctx *server_ctx = arg;
+    struct client *client = (struct client *) ((byte *) timer - offsetof(struct client, idle));
+    const uint_64 idle_at = client->active_at + server_ctx->idle_timeout_ns;
+
+    if (server_ctx->protocol == SHM && client->shm == NULL) {
+        log_debug(DEBUG, NOERR, "Closing connection that never sent its shared memory channel");
+        close_client(server_ctx, client);
+        return;
+    }
+
+    if (idle_at > timer_wheel_now_ns(server_ctx->timers)) {
+        timer_arm(server_ctx->timers, timer, idle_at);
+        return;
+    }
+
+    log_debug(DEBUG, NOERR, "Closing connection idle for %lu s", (unsigned long) (server_ctx->idle_timeout_ns / 1000000000U));
+    close_client(server_ctx, client);
+
+    metrics_add(METRIC_CONNECTIONS_REAPED, 1);
+}
+
 static void accept_connection(rh_server_ctx *const server_ctx) {
-    int client_fd = accept(server_ctx->server_fd, NULL, NULL);
+    struct sockaddr_storage address = {0};
+    socklen_t address_len = sizeof(address);
+    int client_fd = accept(server_ctx->server_fd, (struct sockaddr *) &address, &address_len);
 
     if (client_fd > 0) {
-        struct client *client = malloc(sizeof(struct client));
+        struct client *client;
+
+        if (fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK) < 0) {
+            log_error(WARN, errno, "Failed to set up connection");
+            close(client_fd);
+            return;
+        }
+
+        if (NULL == (client = client_alloc(server_ctx))) {
+            log_error(WARN, errno, "Connection table is full");
+            close(client_fd);
+            return;
+        }
+
         client->fd = client_fd;
-        client->pos = server_ctx->clients_count;
+        client->shm = NULL;
+        memset(&client->address, 0, sizeof(client->address));
+        client->buffered = 0;
+        client->output = client->output_tail = NULL;
+        client->output_offset = 0;
+        client->output_size = 0;
+        client->active_at = clock_now_ns();
+        timer_init(&client->idle, idle_expired, server_ctx);
+
+        /* a SHM client is only served once its descriptors arrive, which must be soon whatever the idle timeout */
+        if (server_ctx->protocol == SHM)
+            timer_arm(server_ctx->timers, &client->idle, client->active_at + SHM_HANDSHAKE_NS);
+        else if (server_ctx->idle_timeout_ns > 0)
+            timer_arm(server_ctx->timers, &client->idle, client->active_at + server_ctx->idle_timeout_ns);
+
+        /* local peers have no address to report */
+        if (address.ss_family == AF_INET)
+            memcpy(&client->address, &address, sizeof(client->address));
+
+        metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+    }
+}
+
+/* Pairs with the store before select(): either the reactor sees what was posted or this sees it asleep */
+static void wake_reactor(rh_server_ctx *const server_ctx) {
+    const uint_64 eventfd_value = 1;
+
+    if (__atomic_load_n(&server_ctx->asleep, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&server_ctx->asleep, 0, __ATOMIC_SEQ_CST) &&
+        write(server_ctx->wakeup_fd, &eventfd_value, sizeof(eventfd_value)) < 0)
+        log_error(WARN, errno, "Failed to wake up reactor");
+}
+
+/* Called from any thread: data NULL asks the reactor to close the connection */
+static void post_reply(rh_server_ctx *const server_ctx, const uint_32 client_handle, const byte *const data, const usize data_size) {
+    const uint_8 header = RH_FRAMED(server_ctx->protocol) ? RH_FRAME_HEADER : 0;
+    struct reply *reply = malloc(sizeof(struct reply) + header + data_size);
+
+    reply->client_handle = client_handle;
+    reply->size = data != NULL ? (uint_16) (header + data_size) : 0;
+    if (header > 0) {
+        reply->frame[0] = (byte) (data_size >> 8U);
+        reply->frame[1] = (byte) data_size;
+    }
+
+    if (data != NULL)
+        memcpy(reply->frame + header, data, data_size);
+
+    reply->next = __atomic_load_n(&server_ctx->mailbox, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&server_ctx->mailbox, &reply->next, reply, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        continue;
+
+    wake_reactor(server_ctx);
+}
+
+/* Called from any thread once a request is done with, whether it was answered or not: wakes the reactor up when that
+ * lets it read from the connection again */
+static void client_release(rh_server_ctx *const server_ctx, const uint_32 handle) {
+    const uint_16 pos = (uint_16) handle;
+    struct client *slab = __atomic_load_n(&server_ctx->slabs[pos / SLAB_CLIENTS], __ATOMIC_ACQUIRE);
+    struct client *client = &slab[pos % SLAB_CLIENTS];
+    uint_64 in_flight = __atomic_load_n(&client->in_flight, __ATOMIC_SEQ_CST);
+
+    do {
+        if (in_flight >> 32U != handle >> 16U)
+            return;
+    } while (!__atomic_compare_exchange_n(&client->in_flight, &in_flight, in_flight - 1, true, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST));
+
+    if (server_ctx->in_flight_limit > 0 && (uint_32) in_flight >= server_ctx->in_flight_limit)
+        wake_reactor(server_ctx);
+}
+
+/* Writes as much of the client output as the socket takes, with a single writev() for several replies when its frames
+ * are not messages of their own: false when the connection failed */
+static bool flush_output(const rh_server_ctx *const server_ctx, struct client *const client) {
+    const uint_8 batch = RH_FRAMED(server_ctx->protocol) ? IOV_BATCH : 1;
+    const uint_8 header = RH_FRAMED(server_ctx->protocol) ? RH_FRAME_HEADER : 0;
+    struct iovec iov[IOV_BATCH];
+    struct reply *reply, *next;
+    ssize written;
+    int count;
+
+    while (client->output != NULL) {
+        for (reply = client->output, count = 0; reply != NULL && count < batch; reply = reply->next, ++count) {
+            iov[count].iov_base = reply->frame;
+            iov[count].iov_len = reply->size;
+        }
+
+        iov[0].iov_base = client->output->frame + client->output_offset;
+        iov[0].iov_len -= client->output_offset;
+
+        if ((written = writev(client->fd, iov, count)) < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        client->active_at = timer_wheel_now_ns(server_ctx->timers);
+        client->output_size -= (usize) written;
+        written += client->output_offset;
+
+        for (reply = client->output; reply != NULL && written >= reply->size; reply = next) {
+            next = reply->next;
+            written -= reply->size;
+            metrics_add(METRIC_BYTES_SENT, (usize) (reply->size - header));
+            free(reply);
+        }
+
+        client->output = reply;
+        client->output_offset = (uint_16) written;
+
+        if (reply == NULL)
+            client->output_tail = NULL;
+        else if (written > 0)
+            return true;
+    }
+
+    return true;
+}
+
+/* Moves the replies of a connection to its output in the order they were posted, and writes them; closes the
+ * connection when asked to, on failure, or when it let more than OUTPUT_MAX bytes pile up */
+static void drain_mailbox(rh_server_ctx *const server_ctx) {
+    struct reply *reply, *fifo = NULL, *next;
+    struct client *client;
+    bool failed;
 
-        if (server_ctx->clients_count == server_ctx->clients_capacity) {
-            server_ctx->clients_capacity *= 2;
-            server_ctx->clients = realloc(server_ctx->clients, server_ctx->clients_capacity);
+    if (__atomic_load_n(&server_ctx->mailbox, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    reply = __atomic_exchange_n(&server_ctx->mailbox, NULL, __ATOMIC_ACQUIRE);
+
+    /* the stack holds the newest reply first */
+    for (; reply != NULL; reply = next) {
+        next = reply->next;
+        reply->next = fifo;
+        fifo = reply;
+    }
+
+    for (; fifo != NULL; fifo = next) {
+        next = fifo->next;
+
+        /* a connection closed before its replies were written may already have its slot serving another one */
+        if (NULL == (client = client_get(server_ctx, fifo->client_handle))) {
+            free(fifo);
+            continue;
+        }
+
+        if (fifo->size == 0) {
+            free(fifo);
+            close_client(server_ctx, client);
+            continue;
+        }
+
+        if (client->shm != NULL) {
+            failed = !shm_push(client->shm, SHM_REPLIES, fifo->frame, fifo->size);
+
+            if (!failed) {
+                client->active_at = timer_wheel_now_ns(server_ctx->timers);
+                metrics_add(METRIC_BYTES_SENT, fifo->size);
+            }
+
+            free(fifo);
+        } else {
+            fifo->next = NULL;
+
+            if (client->output_tail != NULL)
+                client->output_tail->next = fifo;
+            else
+                client->output = fifo;
+
+            client->output_tail = fifo;
+            client->output_size += fifo->size;
+
+            /* the following replies of the same connection are written along, with the same writev() */
+            failed = (next == NULL || next->client_handle != fifo->client_handle || next->size == 0) &&
+                     !flush_output(server_ctx, client);
+
+            if (!failed && client->output_size > OUTPUT_MAX) {
+                log_debug(DEBUG, NOERR, "Closing connection not reading its replies");
+                failed = true;
+            }
         }
 
-        server_ctx->clients[server_ctx->clients_count++] = client;
+        if (failed)
+            close_client(server_ctx, client);
+    }
+}
+
+/* Writes more of the output of the clients whose socket got room for it */
+static void flush_clients(rh_server_ctx *const server_ctx, const fd_set *const fds) {
+    struct client *client;
+
+    for (uint_16 i = 0; i < server_ctx->clients_count; ++i) {
+        if (NULL != (client = client_at(server_ctx, i)) && client->output != NULL &&
+            FD_ISSET(client->fd, fds) && !flush_output(server_ctx, client))  /* NOLINT(hicpp-signed-bitwise) */
+            close_client(server_ctx, client);
     }
 }
 
 static struct client *get_client_addr(const rh_server_ctx *const server_ctx, const fd_set *const fds) {
+    struct client *client, *ready = NULL;
+
+    for (uint_16 i = 0; i < server_ctx->clients_count; ++i) {
+        if (NULL == (client = client_at(server_ctx, i)))
+            continue;
+
+        /* every SHM client is awake again, or its producer would keep signaling it while the reactor spins */
+        if (client->shm != NULL)
+            shm_wake(client->shm, SHM_REQUESTS, FD_ISSET(shm_wakeup_fd(client->shm, SHM_REQUESTS), fds));  /* NOLINT(hicpp-signed-bitwise) */
+
+        if (ready == NULL && !client->paused &&
+            (FD_ISSET(client->fd, fds) || (client->shm != NULL && shm_ready(client->shm, SHM_REQUESTS))))  /* NOLINT(hicpp-signed-bitwise) */
+            ready = client;
+    }
+
+    return ready;
+}
+
+/* Looks for a SHM client with a request, starting after the last one served so that none of them starves the others */
+static struct client *next_shm_client(rh_server_ctx *const server_ctx) {
+    struct client *client;
+
+    for (uint_16 i = 0; i < server_ctx->clients_count; ++i) {
+        const uint_16 pos = (uint_16) ((server_ctx->shm_next + i) % server_ctx->clients_count);
+
+        if (NULL != (client = client_at(server_ctx, pos)) && client->shm != NULL && !client->paused &&
+            shm_ready(client->shm, SHM_REQUESTS)) {
+            server_ctx->shm_next = (uint_16) (pos + 1);
+            return client;
+        }
+    }
+
+    return NULL;
+}
+
+/* Spins over the SHM clients and the mailbox for a while, then flags them all asleep before select() so that the next
+ * request written to any of them signals its eventfd */
+static struct client *poll_shm_clients(rh_server_ctx *const server_ctx) {
+    const uint_64 deadline = clock_now_ns() + shm_spin_ns();
+    struct client *client;
+
+    do {
+        drain_mailbox(server_ctx);
+
+        if (NULL != (client = next_shm_client(server_ctx)))
+            return client;
+    } while (clock_now_ns() < deadline);
+
     for (uint_16 i = 0; i < server_ctx->clients_count; ++i) {
-        if (server_ctx->clients[i] != NULL && FD_ISSET(server_ctx->clients[i]->fd, fds))  /* NOLINT(hicpp-signed-bitwise) */
-            return server_ctx->clients[i];
+        if (NULL != (client = client_at(server_ctx, i)) && client->shm != NULL && !client->paused &&
+            !shm_sleep(client->shm, SHM_REQUESTS))
+            return client;
+    }
+
+    return NULL;
+}
+
+/* Maps the channel whose descriptors a new SHM client sends once connected, without waiting for them: -2 once it is
+ * set up or while they have not arrived yet, 0 when the connection must be closed */
+static ssize attach_shm(rh_server_ctx *const server_ctx, struct client *const client) {
+    int fds[SHM_FDS];
+
+    if (!shm_recv_fds(client->fd, fds)) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -2;
+
+        log_debug(DEBUG, errno, "Failed to receive shared memory channel");
+        return 0;
+    }
+
+    if (NULL == (client->shm = shm_channel_attach(fds))) {
+        log_debug(DEBUG, errno, "Failed to set up shared memory channel");
+        return 0;
+    }
+
+    if (server_ctx->idle_timeout_ns > 0)
+        timer_arm(server_ctx->timers, &client->idle, client->active_at + server_ctx->idle_timeout_ns);
+    else
+        timer_cancel(server_ctx->timers, &client->idle);
+
+    return -2;
+}
+
+/* Takes the next request out of the ring, or finds out whether the client closed its socket */
+static ssize read_shm(struct client *const client, byte *const data) {
+    ssize data_size;
+    byte probe;
+
+    if ((data_size = (ssize) shm_pop(client->shm, SHM_REQUESTS, data)) > 0)
+        return data_size;
+
+    if ((data_size = recv(client->fd, &probe, sizeof(probe), MSG_DONTWAIT)) == 0 || (data_size < 0 && errno != EAGAIN))
+        return data_size;
+
+    return -2;
+}
+
+static uint_16 frame_size(const struct client *const client) {
+    return client->buffered < RH_FRAME_HEADER ? 0 : (uint_16) (client->buffer[0] << 8U | client->buffer[1]);
+}
+
+static bool frame_complete(const struct client *const client) {
+    return client->buffered >= RH_FRAME_HEADER && client->buffered >= RH_FRAME_HEADER + frame_size(client);
+}
+
+/* Reads what the client sent and takes the first complete frame out of its buffer: -2 while it is still incomplete,
+ * -1 on a frame that could never fit, or the read() result when the connection failed or was closed */
+static ssize read_frame(rh_server_ctx *const server_ctx, struct client *const client, byte *const data) {
+    ssize data_size;
+    uint_16 size;
+
+    if (!frame_complete(client)) {
+        if ((data_size = read(client->fd, client->buffer + client->buffered, sizeof(client->buffer) - client->buffered)) <= 0)
+            return data_size;
+
+        client->buffered = (uint_16) (client->buffered + data_size);
+    }
+
+    if ((size = frame_size(client)) > RH_FRAME_MAX || (client->buffered >= RH_FRAME_HEADER && size == 0)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (!frame_complete(client))
+        return -2;
+
+    memcpy(data, client->buffer + RH_FRAME_HEADER, size);
+    client->buffered = (uint_16) (client->buffered - RH_FRAME_HEADER - size);
+    memmove(client->buffer, client->buffer + RH_FRAME_HEADER + size, client->buffered);
+
+    /* a client that pipelines may have sent more frames in the same segment, they are served before select() again */
+    server_ctx->pending = frame_complete(client) ? client : NULL;
+
+    return size;
+}
+
+static bool client_throttled(const rh_server_ctx *const server_ctx, const struct client *const client) {
+    return server_ctx->in_flight_limit > 0 &&
+           (uint_32) __atomic_load_n(&client->in_flight, __ATOMIC_SEQ_CST) >= server_ctx->in_flight_limit;
+}
+
+/* Counts a request taken out of the connection, and stops reading from it once it has as many in flight as allowed: the
+ * kernel buffers fill up then, and flow control pushes back on the sender */
+static void client_acquire(rh_server_ctx *const server_ctx, struct client *const client) {
+    __atomic_add_fetch(&client->in_flight, 1, __ATOMIC_SEQ_CST);
+
+    if (!client->paused && client_throttled(server_ctx, client)) {
+        client->paused = true;
+        ++server_ctx->paused_count;
+
+        if (server_ctx->pending == client)
+            server_ctx->pending = NULL;
+
+        metrics_add(METRIC_CONNECTIONS_PAUSED, 1);
+    }
+}
+
+/* Reads again from the connections paused that got below their limit; returns one that still has frames buffered, as
+ * nothing would wake select() up for them, leaving the others for the next calls */
+static struct client *resume_clients(rh_server_ctx *const server_ctx) {
+    struct client *client;
+
+    for (uint_16 i = 0; i < server_ctx->clients_count && server_ctx->paused_count > 0; ++i) {
+        if (NULL == (client = client_at(server_ctx, i)) || !client->paused || client_throttled(server_ctx, client))
+            continue;
+
+        client->paused = false;
+        --server_ctx->paused_count;
+
+        if (client->shm == NULL && RH_FRAMED(server_ctx->protocol) && frame_complete(client))
+            return client;
     }
 
     return NULL;
 }
 
+/* Fires the timers due, reading the clock only when there are any */
+static void run_timers(rh_server_ctx *const server_ctx) {
+    if (timer_wheel_count(server_ctx->timers) > 0)
+        timer_advance(server_ctx->timers, clock_now_ns());
+}
+
+/* Bounds select() by the next timer, rounding up to the microsecond so that it is due once select() returns */
+static struct timeval *select_timeout(const rh_server_ctx *const server_ctx, struct timeval *const timeout) {
+    uint_64 us;
+
+    if (timer_wheel_count(server_ctx->timers) == 0)
+        return NULL;
+
+    us = (timer_timeout_ns(server_ctx->timers, clock_now_ns()) + 999) / 1000;
+    timeout->tv_sec = (time_t) (us / 1000000);
+    timeout->tv_usec = (suseconds_t) (us % 1000000);
+
+    return timeout;
+}
+
+/* Flags the reactor as asleep before select(); false when a reply was posted, or a paused connection got below its
+ * limit, in the meantime */
+static bool reactor_sleep(rh_server_ctx *const server_ctx) {
+    const uint_16 paused_count = server_ctx->paused_count;
+
+    __atomic_store_n(&server_ctx->asleep, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&server_ctx->mailbox, __ATOMIC_SEQ_CST) != NULL ||
+        (paused_count > 0 && (NULL != (server_ctx->pending = resume_clients(server_ctx)) ||
+                              server_ctx->paused_count < paused_count))) {
+        __atomic_store_n(&server_ctx->asleep, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
 rh_client_msg *rh_receive_from_client(rh_server_ctx *const server_ctx) {
     rh_client_msg *client_msg = malloc(sizeof(rh_client_msg));
     uint_32 addr_len = sizeof(struct sockaddr_in);
     ssize data_size = -2;
+    uint_64 wakeups;
     int n_fds;
-    fd_set read_fds;
+    fd_set read_fds, write_fds;
+    struct timeval timeout;
     struct client *client = NULL;
 
     client_msg->data = malloc(BUFFER_SIZE);
     client_msg->return_addr = malloc(sizeof(rh_client_addr));
     client_msg->return_addr->server_ctx = server_ctx;
+    client_msg->return_addr->client_handle = CLIENT_NONE;
+    client_msg->return_addr->in_flight = false;
+    server_ctx->owner = pthread_self();
 
-    if (server_ctx->protocol == TCP) {
-        n_fds = build_fd_set(server_ctx, &read_fds);
+    drain_mailbox(server_ctx);
+    run_timers(server_ctx);
 
-        switch (select(n_fds, &read_fds, NULL, NULL, NULL)) {
+    if (server_ctx->pending == NULL && server_ctx->paused_count > 0)
+        server_ctx->pending = resume_clients(server_ctx);
+
+    if (RH_CONNECTED(server_ctx->protocol) && server_ctx->pending != NULL) {
+        client = server_ctx->pending;
+    } else if (server_ctx->protocol == SHM && server_ctx->clients_count > 0 && NULL != (client = poll_shm_clients(server_ctx))) {
+        /* served straight from shared memory, without a syscall */
+    } else if (RH_CONNECTED(server_ctx->protocol) && reactor_sleep(server_ctx)) {
+        n_fds = build_fd_set(server_ctx, &read_fds, &write_fds);
+
+        switch (select(n_fds, &read_fds, &write_fds, NULL, select_timeout(server_ctx, &timeout))) {
             case -1:
                 die(EXIT_FAILURE, errno, "Server error: select()");
             case 0:
+                __atomic_store_n(&server_ctx->asleep, 0, __ATOMIC_RELAXED);
+                run_timers(server_ctx);
                 break;
             default:
-                if (FD_ISSET(server_ctx->server_fd, &read_fds))  /* NOLINT(hicpp-signed-bitwise) */
-                    accept_connection(server_ctx);
+                __atomic_store_n(&server_ctx->asleep, 0, __ATOMIC_RELAXED);
+
+                if (FD_ISSET(server_ctx->wakeup_fd, &read_fds) &&  /* NOLINT(hicpp-signed-bitwise) */
+                    read(server_ctx->wakeup_fd, &wakeups, sizeof(wakeups)) > 0)
+                    drain_mailbox(server_ctx);
 
+                run_timers(server_ctx);
+                flush_clients(server_ctx, &write_fds);
+
+                /* before accepting, as a connection closed since select() may leave its fd number to the new one */
                 client = get_client_addr(server_ctx, &read_fds);
+
+                if (FD_ISSET(server_ctx->server_fd, &read_fds))  /* NOLINT(hicpp-signed-bitwise) */
+                    accept_connection(server_ctx);
         }
+    }
 
-        if (client != NULL) {
-            client_msg->return_addr->client_pos = client->pos;
+    if (client != NULL) {
+        client_msg->return_addr->client_handle = CLIENT_HANDLE(client);
+        client_msg->return_addr->client_address = client->address;
+        client->active_at = timer_wheel_now_ns(server_ctx->timers);
 
-            data_size = read(client->fd, client_msg->data, 512);
-        }
-    } else {
+        client_msg->ready_at = trace_now();
+
+        if (client->shm != NULL)
+            data_size = read_shm(client, client_msg->data);
+        else if (server_ctx->protocol == SHM)
+            data_size = attach_shm(server_ctx, client);
+        else if (!RH_FRAMED(server_ctx->protocol))
+            data_size = read(client->fd, client_msg->data, BUFFER_SIZE);
+        else
+            data_size = read_frame(server_ctx, client, client_msg->data);
+
+        /* the socket does not block, there may be nothing to read after all */
+        if (data_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            data_size = -2;
+    } else if (server_ctx->protocol == UDP) {
         data_size = recvfrom(server_ctx->server_fd, client_msg->data, BUFFER_SIZE, 0,
                              (struct sockaddr *) &client_msg->return_addr->client_address, &addr_len);
+        client_msg->ready_at = trace_now();
     }
 
     if (data_size <= 0) {
@@ -153,54 +955,75 @@ rh_client_msg *rh_receive_from_client(rh_server_ctx *const server_ctx) {
     } else {
         client_msg->data_size = (usize) data_size;
         client_msg->data = realloc(client_msg->data, client_msg->data_size);
+        client_msg->received_at = clock_ticks();
 
-        return client_msg;
-    }
-}
-
-static void close_client(const rh_client_addr *const return_addr) {
-    struct client *client = return_addr->server_ctx->clients[return_addr->client_pos];
-
-    if (client != NULL) {
-        shutdown(client->fd, SHUT_WR);
-
-        byte *buffer = malloc(BUFFER_SIZE);
-
-        for (;;)
-            if ((read(client->fd, buffer, BUFFER_SIZE)) <= 0)
-                break;
+        if (client != NULL) {
+            client_msg->return_addr->in_flight = true;
+            client_acquire(server_ctx, client);
+        }
 
-        close(client->fd);
-        return_addr->server_ctx->clients[client->pos] = NULL;
+        trace_record(TRACE_RECEIVE, client_msg->ready_at, client_msg->received_at);
+        metrics_add(METRIC_BYTES_RECEIVED, client_msg->data_size);
 
-        free(buffer);
-        free(client);
+        return client_msg;
     }
 }
 
 bool rh_send_to_client(const rh_client_addr *const return_addr, const byte *const data, const usize data_size) {
-    if (return_addr->server_ctx->protocol == TCP) {
-        struct client *client = return_addr->server_ctx->clients[return_addr->client_pos];
-
-        if (client && write(client->fd, data, data_size) == (ssize) data_size)
-            return true;
-        else {
-            close_client(return_addr);
+    const uint_64 begin = trace_now();
+    rh_server_ctx *server_ctx = (rh_server_ctx *) return_addr->server_ctx;
 
+    if (RH_CONNECTED(server_ctx->protocol)) {
+        if (data_size == 0 || data_size > RH_FRAME_MAX) {
+            errno = EMSGSIZE;
             return false;
         }
+
+        post_reply(server_ctx, return_addr->client_handle, data, data_size);
+
+        /* the reactor itself, like an echo server, writes right away */
+        if (pthread_equal(server_ctx->owner, pthread_self()))
+            drain_mailbox(server_ctx);
+
+        trace_record(TRACE_SEND, begin, trace_now());
+        return true;
     } else {
-        if (sendto(return_addr->server_ctx->server_fd, data, data_size, 0,
+        if (sendto(server_ctx->server_fd, data, data_size, 0,
                    (const struct sockaddr *) &return_addr->client_address, sizeof(struct sockaddr_in)) != (ssize) data_size)
             return false;
-        else
+        else {
+            trace_record(TRACE_SEND, begin, trace_now());
+            metrics_add(METRIC_BYTES_SENT, data_size);
             return true;
+        }
     }
 }
 
+void rh_client_addr_peer(const rh_client_addr *const return_addr, uint_32 *const ip, uint_16 *const port) {
+    *ip = return_addr->client_address.sin_addr.s_addr;
+    *port = ntohs(return_addr->client_address.sin_port);
+}
+
+uint_64 rh_client_addr_flow(const rh_client_addr *const return_addr) {
+    const uint_64 peer = RH_CONNECTED(return_addr->server_ctx->protocol) ? return_addr->client_handle :
+                         (uint_64) return_addr->client_address.sin_addr.s_addr << 16 | return_addr->client_address.sin_port;
+
+    return (uint_64) (uintptr_t) return_addr->server_ctx ^ peer * 0x9E3779B97F4A7C15ULL;
+}
+
 void rh_client_msg_destroy(rh_client_msg *client_msg, const bool do_close) {
-    if (client_msg->return_addr->server_ctx->protocol == TCP && do_close) {
-        close_client(client_msg->return_addr);
+    rh_server_ctx *server_ctx = (rh_server_ctx *) client_msg->return_addr->server_ctx;
+    const uint_32 handle = client_msg->return_addr->client_handle;
+    struct client *client;
+
+    if (client_msg->return_addr->in_flight)
+        client_release(server_ctx, handle);
+
+    if (RH_CONNECTED(server_ctx->protocol) && do_close) {
+        if (!pthread_equal(server_ctx->owner, pthread_self()))
+            post_reply(server_ctx, handle, NULL, 0);
+        else if (NULL != (client = client_get(server_ctx, handle)))
+            close_client(server_ctx, client);
     }
 
     free(client_msg->data);
@@ -12,14 +12,34 @@ typedef struct {
     byte *data;
     usize data_size;
     rh_client_addr *return_addr;
+    uint_64 ready_at;
+    uint_64 received_at;
 } rh_client_msg;
 
-rh_server_ctx *rh_server_new(enum protocol, uint_16 port_to_listen);
+rh_server_ctx *rh_server_new(enum protocol, uint_16 port_to_listen, const char *path);
+
+/* Sets up the listener of a Unix socket path ahead, for the processes forked afterwards to share it instead of binding
+ * the path in turn; TCP and UDP listeners need nothing, every reactor of any process joins the port with its own */
+bool rh_server_share(enum protocol, const char *path);
+
+/* Connections that neither send a request nor get a reply for that long are closed, by the servers created after the
+ * call; 0, the default, keeps them open until the peer closes them */
+void rh_server_set_idle_timeout(uint_32 seconds);
+
+/* Connections with that many requests received but not yet done with are no longer read from until some are, by the
+ * servers created after the call; 0, the default, never stops reading. Requests over UDP are not counted */
+void rh_server_set_in_flight_limit(uint_32 requests);
 
 rh_client_msg *rh_receive_from_client(rh_server_ctx *);
 
 bool rh_send_to_client(const rh_client_addr *, const byte *data, usize data_size);
 
+void rh_client_addr_peer(const rh_client_addr *, uint_32 *ip, uint_16 *port);
+
+/* The same for every message of a connection, or of a peer when the protocol has none, and unlikely to be shared by
+ * another one of any server of the process */
+uint_64 rh_client_addr_flow(const rh_client_addr *);
+
 void rh_client_msg_destroy(rh_client_msg *, bool do_close);
 
 #endif /* CSOCKET_RH_SERVER_H */
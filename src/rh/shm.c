@@ -0,0 +1,284 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _GNU_SOURCE
+
+#include "shm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "stats/clock.h"
+
+#define CACHE_LINE 64
+#define SPIN_CHECK_EVERY 64
+/* the client can neither resize the memfd under the server, which would fault past its end, nor lift the seals */
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* The head is only written by the consumer and the tail by the producers, each on its own cache line */
+struct shm_ring {
+    uint_32 head __attribute__((aligned(CACHE_LINE)));
+    uint_32 tail __attribute__((aligned(CACHE_LINE)));
+    uint_32 asleep __attribute__((aligned(CACHE_LINE)));
+    uint_16 sizes[SHM_SLOTS] __attribute__((aligned(CACHE_LINE)));
+    byte slots[SHM_SLOTS][RH_FRAME_MAX];
+};
+
+/* The producers of a ring all live in the same process, so the lock between them stays out of the mapping, where the
+ * peer could hold it forever */
+struct shm_channel {
+    struct shm_ring *rings;
+    uint_8 locks[2];
+    int fds[SHM_FDS];
+};
+
+static __always_inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+uint_64 shm_spin_ns(void) {
+    static uint_64 spin_ns = UINT64_MAX;
+
+    if (spin_ns == UINT64_MAX)
+        spin_ns = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_NS : 0;
+
+    return spin_ns;
+}
+
+/* Starts the clock on the first call, true once the spin time elapsed since */
+static bool spin_expired(uint_64 *const deadline) {
+    const uint_64 now = clock_now_ns();
+
+    if (*deadline == 0)
+        *deadline = now + shm_spin_ns();
+
+    return now >= *deadline;
+}
+
+static void spin_wait(void) {
+    if (shm_spin_ns() > 0)
+        cpu_relax();
+    else
+        sched_yield();
+}
+
+static struct shm_channel *channel_map(const int fds[SHM_FDS]) {
+    struct shm_channel *channel;
+    void *rings;
+
+    if (MAP_FAILED == (rings = mmap(NULL, sizeof(struct shm_ring) * 2, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)))
+        return NULL;
+
+    channel = malloc(sizeof(struct shm_channel));
+    channel->rings = rings;
+    channel->locks[SHM_REQUESTS] = channel->locks[SHM_REPLIES] = 0;
+    memcpy(channel->fds, fds, sizeof(channel->fds));
+
+    return channel;
+}
+
+struct shm_channel *shm_channel_new(int fds[SHM_FDS]) {
+    struct shm_channel *channel;
+
+    fds[0] = memfd_create("csocket-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || ftruncate(fds[0], sizeof(struct shm_ring) * 2) < 0 ||
+        fcntl(fds[0], F_ADD_SEALS, SHM_SEALS) < 0 || NULL == (channel = channel_map(fds))) {
+        for (uint_8 i = 0; i < SHM_FDS; ++i) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+
+        return NULL;
+    }
+
+    return channel;
+}
+
+struct shm_channel *shm_channel_attach(const int fds[SHM_FDS]) {
+    struct shm_channel *channel;
+    struct stat st;
+    int seals;
+
+    /* without the seals the client could shrink the file afterwards, and a smaller file faults on the first access
+     * past its end */
+    if ((seals = fcntl(fds[0], F_GET_SEALS)) < 0 || (seals & SHM_SEALS) != SHM_SEALS || fstat(fds[0], &st) < 0 ||
+        st.st_size < (off_t) (sizeof(struct shm_ring) * 2) || NULL == (channel = channel_map(fds))) {
+        for (uint_8 i = 0; i < SHM_FDS; ++i)
+            close(fds[i]);
+
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return channel;
+}
+
+bool shm_send_fds(const int socket_fd, const int fds[SHM_FDS]) {
+    byte marker = 'F';
+    struct iovec iov = {&marker, sizeof(marker)};
+    union {
+        struct cmsghdr header;
+        byte buffer[CMSG_SPACE(sizeof(int) * SHM_FDS)];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    memset(control.buffer, 0, sizeof(control.buffer));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SHM_FDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * SHM_FDS);
+
+    return sendmsg(socket_fd, &msg, 0) == sizeof(marker);
+}
+
+bool shm_recv_fds(const int socket_fd, int fds[SHM_FDS]) {
+    byte marker;
+    struct iovec iov = {&marker, sizeof(marker)};
+    union {
+        struct cmsghdr header;
+        byte buffer[CMSG_SPACE(sizeof(int) * SHM_FDS)];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+    struct cmsghdr *cmsg;
+    const ssize received = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+
+    if (received < 0)
+        return false;
+
+    if (received != sizeof(marker) || NULL == (cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * SHM_FDS)) {
+        errno = EPROTO;
+        return false;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * SHM_FDS);
+
+    return true;
+}
+
+bool shm_push(struct shm_channel *const channel, const enum shm_direction direction, const byte *const data, const usize size) {
+    struct shm_ring *ring = &channel->rings[direction];
+    const uint_64 eventfd_value = 1;
+    uint_64 deadline = 0;
+    uint_32 tail;
+
+    if (size == 0 || size > RH_FRAME_MAX) {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    while (__atomic_test_and_set(&channel->locks[direction], __ATOMIC_ACQUIRE))
+        spin_wait();
+
+    tail = ring->tail;
+
+    /* a full ring waits for the consumer at least SHM_SPIN_NS even on a single CPU, where it yields to let it run */
+    for (uint_32 i = 0; tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == SHM_SLOTS; ++i) {
+        if (deadline == 0)
+            deadline = clock_now_ns() + SHM_SPIN_NS;
+        else if (i % SPIN_CHECK_EVERY == 0 && clock_now_ns() > deadline) {
+            __atomic_clear(&channel->locks[direction], __ATOMIC_RELEASE);
+            errno = ENOBUFS;
+            return false;
+        }
+
+        spin_wait();
+    }
+
+    memcpy(ring->slots[tail % SHM_SLOTS], data, size);
+    ring->sizes[tail % SHM_SLOTS] = (uint_16) size;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    __atomic_clear(&channel->locks[direction], __ATOMIC_RELEASE);
+
+    /* pairs with the store in shm_sleep(): either the consumer sees the new tail or this sees it asleep. The message is
+     * pushed either way, a failed wakeup only leaves it to the next one */
+    if (__atomic_load_n(&ring->asleep, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&ring->asleep, 0, __ATOMIC_SEQ_CST) &&
+        write(channel->fds[1 + direction], &eventfd_value, sizeof(eventfd_value)) != sizeof(eventfd_value))
+        log_debug(DEBUG, errno, "Failed to wake up shared memory consumer");
+
+    return true;
+}
+
+usize shm_pop(struct shm_channel *const channel, const enum shm_direction direction, byte *const data) {
+    struct shm_ring *ring = &channel->rings[direction];
+    const uint_32 head = ring->head;
+    usize size;
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    /* the peer may write anything to the shared sizes */
+    if ((size = ring->sizes[head % SHM_SLOTS]) > RH_FRAME_MAX)
+        size = RH_FRAME_MAX;
+
+    memcpy(data, ring->slots[head % SHM_SLOTS], size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return size;
+}
+
+bool shm_ready(const struct shm_channel *const channel, const enum shm_direction direction) {
+    const struct shm_ring *ring = &channel->rings[direction];
+
+    return ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+bool shm_spin(const struct shm_channel *const channel, const enum shm_direction direction) {
+    uint_64 deadline = 0;
+
+    for (uint_32 i = 0; !shm_ready(channel, direction); ++i) {
+        if (i % SPIN_CHECK_EVERY == 0 && spin_expired(&deadline))
+            return false;
+
+        cpu_relax();
+    }
+
+    return true;
+}
+
+bool shm_sleep(struct shm_channel *const channel, const enum shm_direction direction) {
+    struct shm_ring *ring = &channel->rings[direction];
+
+    __atomic_store_n(&ring->asleep, 1, __ATOMIC_SEQ_CST);
+
+    if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&ring->asleep, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
+void shm_wake(struct shm_channel *const channel, const enum shm_direction direction, const bool signaled) {
+    uint_64 eventfd_value;
+
+    __atomic_store_n(&channel->rings[direction].asleep, 0, __ATOMIC_RELAXED);
+
+    if (signaled && read(channel->fds[1 + direction], &eventfd_value, sizeof(eventfd_value)) < 0)
+        errno = 0;
+}
+
+int shm_wakeup_fd(const struct shm_channel *const channel, const enum shm_direction direction) {
+    return channel->fds[1 + direction];
+}
+
+void shm_channel_destroy(struct shm_channel *const channel) {
+    munmap(channel->rings, sizeof(struct shm_ring) * 2);
+
+    for (uint_8 i = 0; i < SHM_FDS; ++i)
+        close(channel->fds[i]);
+
+    free(channel);
+}
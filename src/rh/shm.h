@@ -0,0 +1,59 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_RH_SHM_H
+#define CSOCKET_RH_SHM_H
+
+#include "types/primitive.h"
+#include "types.h"
+
+/* A SHM connection is a memory-mapped pair of rings, one per direction, set up over a Unix stream socket that only
+ * carries the file descriptors and, by closing, the end of the connection. Each ring has one consumer, which spins for
+ * SHM_SPIN_NS before it sleeps on the ring eventfd: producers only write to it when the consumer is asleep. On a single
+ * CPU the producer could not run while the consumer spins, so there it sleeps right away */
+#define SHM_SLOTS 64
+#define SHM_SPIN_NS 50000
+#define SHM_FDS 3
+
+enum shm_direction {
+    SHM_REQUESTS,
+    SHM_REPLIES
+};
+
+struct shm_channel;
+
+/* Client side: creates the channel and the descriptors to send to the server, the memfd and one eventfd per ring */
+struct shm_channel *shm_channel_new(int fds[SHM_FDS]);
+
+/* Server side: maps the channel whose descriptors were received, taking ownership of them. Fails with EPROTO unless
+ * the memfd is sealed against resizing */
+struct shm_channel *shm_channel_attach(const int fds[SHM_FDS]);
+
+bool shm_send_fds(int socket_fd, const int fds[SHM_FDS]);
+
+/* Does not block: fails with EAGAIN until the descriptors arrived, with EPROTO on anything else */
+bool shm_recv_fds(int socket_fd, int fds[SHM_FDS]);
+
+/* Safe to call from several threads, waits up to SHM_SPIN_NS for a free slot and fails with ENOBUFS otherwise */
+bool shm_push(struct shm_channel *, enum shm_direction, const byte *data, usize size);
+
+/* Returns 0 when the ring is empty, the message size otherwise */
+usize shm_pop(struct shm_channel *, enum shm_direction, byte *data);
+
+bool shm_ready(const struct shm_channel *, enum shm_direction);
+
+/* Spins until the ring has a message or SHM_SPIN_NS elapse, returning whether it has one */
+bool shm_spin(const struct shm_channel *, enum shm_direction);
+
+/* How long consumers spin before they sleep: SHM_SPIN_NS, or 0 on a single CPU */
+uint_64 shm_spin_ns(void);
+
+/* Flags the consumer as asleep; false when a message arrived in the meantime, so that it must not go to sleep */
+bool shm_sleep(struct shm_channel *, enum shm_direction);
+
+/* Clears the asleep flag once the consumer is awake, and the eventfd when it was signaled */
+void shm_wake(struct shm_channel *, enum shm_direction, bool signaled);
+
+int shm_wakeup_fd(const struct shm_channel *, enum shm_direction);
+
+void shm_channel_destroy(struct shm_channel *);
+
+#endif /* CSOCKET_RH_SHM_H */
@@ -0,0 +1,182 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "timer.h"
+
+#include <stdlib.h>
+
+#define SLOT_BITS 6U
+#define SLOT_MASK (TIMER_SLOTS - 1U)
+#define LEVEL_SHIFT(level) ((level) * SLOT_BITS)
+#define WHEEL_SPAN (1ULL << LEVEL_SHIFT(TIMER_LEVELS))
+#define NOT_ARMED UINT8_MAX
+
+/* Every time is kept in ticks. The occupied bitmaps tell which slots hold timers, so that the next one due is found
+ * without walking empty slots */
+struct timer_wheel {
+    uint_64 current;
+    uint_32 count;
+    uint_64 occupied[TIMER_LEVELS];
+    struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+struct timer_wheel *timer_wheel_new(const uint_64 now_ns) {
+    struct timer_wheel *wheel = calloc(1, sizeof(struct timer_wheel));
+
+    wheel->current = now_ns / TIMER_TICK_NS;
+
+    return wheel;
+}
+
+void timer_init(struct timer *const timer, timer_callback *const callback, void *const arg) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->level = NOT_ARMED;
+    timer->slot = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+bool timer_armed(const struct timer *const timer) {
+    return timer->level != NOT_ARMED;
+}
+
+/* Puts the timer on the lowest level whose turn still covers its expiry, relative to the current tick */
+static void insert(struct timer_wheel *const wheel, struct timer *const timer) {
+    uint_64 delta = timer->expires > wheel->current ? timer->expires - wheel->current : 0;
+    uint_8 level = 0;
+
+    if (delta >= WHEEL_SPAN) {
+        delta = WHEEL_SPAN - 1;
+        timer->expires = wheel->current + delta;
+    }
+
+    while (delta >= 1ULL << LEVEL_SHIFT(level + 1U))
+        ++level;
+
+    timer->level = level;
+    timer->slot = (uint_8) ((timer->expires >> LEVEL_SHIFT(level)) & SLOT_MASK);
+    timer->prev = NULL;
+    timer->next = wheel->slots[level][timer->slot];
+
+    if (timer->next != NULL)
+        timer->next->prev = timer;
+
+    wheel->slots[level][timer->slot] = timer;
+    wheel->occupied[level] |= 1ULL << timer->slot;
+}
+
+static void unlink_timer(struct timer_wheel *const wheel, struct timer *const timer) {
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else if (NULL == (wheel->slots[timer->level][timer->slot] = timer->next))
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+
+    timer->next = timer->prev = NULL;
+    timer->level = NOT_ARMED;
+}
+
+void timer_arm(struct timer_wheel *const wheel, struct timer *const timer, const uint_64 expires_ns) {
+    const uint_64 expires = (expires_ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+
+    if (timer_armed(timer))
+        unlink_timer(wheel, timer);
+    else
+        ++wheel->count;
+
+    /* the slot of the current tick already fired */
+    timer->expires = expires > wheel->current ? expires : wheel->current + 1;
+    insert(wheel, timer);
+}
+
+void timer_cancel(struct timer_wheel *const wheel, struct timer *const timer) {
+    if (timer_armed(timer)) {
+        unlink_timer(wheel, timer);
+        --wheel->count;
+    }
+}
+
+/* The first tick after the current one at which a slot of some level holds timers: to fire them on level 0, or to
+ * move them down a level otherwise */
+static uint_64 next_tick(const struct timer_wheel *const wheel) {
+    uint_64 next = UINT64_MAX, tick, rotated;
+    uint_8 start;
+
+    for (uint_8 level = 0; level < TIMER_LEVELS; ++level) {
+        if (wheel->occupied[level] == 0)
+            continue;
+
+        /* the slots after the current one come first, the current one itself last, a whole turn later */
+        start = (uint_8) (((wheel->current >> LEVEL_SHIFT(level)) + 1) & SLOT_MASK);
+        rotated = start == 0 ? wheel->occupied[level] :
+                  wheel->occupied[level] >> start | wheel->occupied[level] << (TIMER_SLOTS - start);
+        tick = ((wheel->current >> LEVEL_SHIFT(level)) + (uint_64) __builtin_ctzll(rotated) + 1) << LEVEL_SHIFT(level);
+
+        if (tick < next)
+            next = tick;
+    }
+
+    return next;
+}
+
+uint_32 timer_advance(struct timer_wheel *const wheel, const uint_64 now_ns) {
+    const uint_64 target = now_ns / TIMER_TICK_NS;
+    struct timer *timer;
+    uint_64 tick;
+    uint_32 fired = 0;
+
+    while (wheel->current < target) {
+        if ((tick = next_tick(wheel)) > target) {
+            wheel->current = target;
+            break;
+        }
+
+        wheel->current = tick;
+
+        /* upper levels first, as they may move timers into the slot of a lower level that is due right now */
+        for (uint_8 level = TIMER_LEVELS - 1; level > 0; --level) {
+            const uint_8 slot = (uint_8) ((tick >> LEVEL_SHIFT(level)) & SLOT_MASK);
+
+            if ((tick & ((1ULL << LEVEL_SHIFT(level)) - 1)) != 0)
+                continue;
+
+            while (NULL != (timer = wheel->slots[level][slot])) {
+                unlink_timer(wheel, timer);
+                insert(wheel, timer);
+            }
+        }
+
+        /* one at a time, as a callback may cancel or arm other timers of the same slot */
+        while (NULL != (timer = wheel->slots[0][tick & SLOT_MASK])) {
+            unlink_timer(wheel, timer);
+            --wheel->count;
+            ++fired;
+
+            timer->callback(timer, timer->arg);
+        }
+    }
+
+    return fired;
+}
+
+uint_64 timer_timeout_ns(const struct timer_wheel *const wheel, const uint_64 now_ns) {
+    const uint_64 tick = next_tick(wheel);
+
+    if (tick == UINT64_MAX)
+        return UINT64_MAX;
+
+    return tick * TIMER_TICK_NS > now_ns ? tick * TIMER_TICK_NS - now_ns : 0;
+}
+
+uint_64 timer_wheel_now_ns(const struct timer_wheel *const wheel) {
+    return wheel->current * TIMER_TICK_NS;
+}
+
+uint_32 timer_wheel_count(const struct timer_wheel *const wheel) {
+    return wheel->count;
+}
+
+void timer_wheel_destroy(struct timer_wheel *const wheel) {
+    free(wheel);
+}
@@ -0,0 +1,56 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_RH_TIMER_H
+#define CSOCKET_RH_TIMER_H
+
+#include "types/primitive.h"
+
+/* A hierarchical timer wheel: TIMER_LEVELS wheels of TIMER_SLOTS slots, where a slot of each level spans a whole turn of
+ * the level below. Arming and cancelling are O(1) whatever the number of timers, and the timers of an upper level move
+ * down when their turn comes, until they fire together with every other timer due at the same tick. Timers are
+ * embedded in their owner, and are only ever touched by the thread that advances their wheel */
+#define TIMER_TICK_NS 1000000U
+#define TIMER_SLOTS 64
+#define TIMER_LEVELS 4
+
+struct timer;
+
+typedef void (timer_callback)(struct timer *, void *arg);
+
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint_64 expires;
+    uint_8 level;
+    uint_8 slot;
+    timer_callback *callback;
+    void *arg;
+};
+
+struct timer_wheel;
+
+struct timer_wheel *timer_wheel_new(uint_64 now_ns);
+
+void timer_init(struct timer *, timer_callback *, void *arg);
+
+/* Moves the timer if it was already armed; a deadline already past fires on the next tick, one beyond the reach of
+ * the wheel (about 4.6 hours) at the end of it */
+void timer_arm(struct timer_wheel *, struct timer *, uint_64 expires_ns);
+
+void timer_cancel(struct timer_wheel *, struct timer *);
+
+bool timer_armed(const struct timer *);
+
+/* Fires every timer due by now_ns, returning how many */
+uint_32 timer_advance(struct timer_wheel *, uint_64 now_ns);
+
+/* How long until the wheel has anything to do, UINT64_MAX when it has no timers */
+uint_64 timer_timeout_ns(const struct timer_wheel *, uint_64 now_ns);
+
+/* The time of the last tick the wheel advanced to, a cheap clock for its owner */
+uint_64 timer_wheel_now_ns(const struct timer_wheel *);
+
+uint_32 timer_wheel_count(const struct timer_wheel *);
+
+void timer_wheel_destroy(struct timer_wheel *);
+
+#endif /* CSOCKET_RH_TIMER_H */
@@ -2,9 +2,25 @@
 #ifndef CSOCKET_RH_TYPES_H
 #define CSOCKET_RH_TYPES_H
 
+/* Stream messages (TCP, UNIX) are framed by a big-endian uint_16 size prefix, UDP and SEQPACKET ones by their datagram */
+#define RH_FRAME_MAX 1024
+#define RH_FRAME_HEADER 2
+
+/* How long a client waits to connect or for a reply before it gives up */
+#define RH_TIMEOUT_MS 5000
+
+/* UNIX and SEQPACKET are local stream and seqpacket sockets, and SHM shared memory rings set up over a Unix stream
+ * socket, all of them addressed by a path instead of a host and port */
 enum protocol {
     TCP,
-    UDP
+    UDP,
+    UNIX,
+    SEQPACKET,
+    SHM
 };
 
+#define RH_CONNECTED(protocol) ((protocol) != UDP)
+#define RH_FRAMED(protocol) ((protocol) == TCP || (protocol) == UNIX)
+#define RH_LOCAL(protocol) ((protocol) == UNIX || (protocol) == SEQPACKET || (protocol) == SHM)
+
 #endif /* CSOCKET_RH_TYPES_H */
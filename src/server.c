@@ -2,7 +2,6 @@
 #include "server.h"
 
 #include "i/invoker.h"
-#include "i/service.h"
 
 static bool data_to_params(const data *d, uint_16 *const a, uint_16 *const b) {
     const value *const v_a = data_get_value(d, 0);
@@ -57,14 +56,22 @@ static void calc_div(const data *const d, data *const r) {
     }
 }
 
-void run_server(const enum protocol protocol, const uint_16 port, const uint_8 thread_num, const uint_8 instances_num) {
-    struct service *service = service_new("calc", 4, instances_num);
-    struct invoker *invoker = invoker_new(protocol, port, thread_num);
+struct service *calc_service_new(const uint_8 methods_capacity, const uint_8 instances_num) {
+    struct service *service = service_new("calc", methods_capacity, instances_num);
 
-    service_add_method(service, "add", calc_add);
-    service_add_method(service, "sub", calc_sub);
-    service_add_method(service, "mul", calc_mul);
-    service_add_method(service, "div", calc_div);
+    /* the arithmetic answers right away, so it goes ahead of any slower method added at the default priority */
+    service_add_method(service, "add", calc_add, METHOD_PURE | METHOD_PRIORITY(1));
+    service_add_method(service, "sub", calc_sub, METHOD_PURE | METHOD_PRIORITY(1));
+    service_add_method(service, "mul", calc_mul, METHOD_PURE | METHOD_PRIORITY(1));
+    service_add_method(service, "div", calc_div, METHOD_PURE | METHOD_PRIORITY(1));
+
+    return service;
+}
+
+void run_server(const enum protocol protocol, const uint_16 port, const char *const path, const uint_8 thread_num,
+                const uint_8 instances_num, const uint_32 cache_entries, const bool coroutines) {
+    struct service *service = calc_service_new(CALC_METHODS, instances_num);
+    struct invoker *invoker = invoker_new(protocol, port, path, thread_num, cache_entries, coroutines);
 
     invoker_run(invoker, service);
 }
@@ -4,7 +4,14 @@
 
 #include "types/primitive.h"
 #include "rh/types.h"
+#include "i/service.h"
 
-__attribute__((noreturn)) void run_server(enum protocol protocol, uint_16 port, uint_8 thread_num, uint_8 instances_num);
+#define CALC_METHODS 4
+
+/* The calc service with its methods, leaving room for methods_capacity - CALC_METHODS more */
+struct service *calc_service_new(uint_8 methods_capacity, uint_8 instances_num);
+
+__attribute__((noreturn)) void run_server(enum protocol protocol, uint_16 port, const char *path, uint_8 thread_num,
+                                         uint_8 instances_num, uint_32 cache_entries, bool coroutines);
 
 #endif /* CSOCKET_SERVER_H */
@@ -0,0 +1,162 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "clock.h"
+
+#define MAGIC "CSKCAP01"
+#define MAGIC_SIZE 8
+#define HEADER_SIZE (sizeof(uint_64) + sizeof(uint_16))
+#define FLUSH_NS 100000000U
+
+struct capture {
+    byte *map;
+    usize size;
+    usize pos;
+};
+
+bool capture_enabled = false;
+
+static FILE *file = NULL;
+
+static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint_64 started_at = 0;
+
+static uint_64 flushed_at = 0;
+
+bool capture_start(const char *const path) {
+    if (NULL == (file = fopen(path, "wb")))
+        return false;
+
+    if (fwrite(MAGIC, 1, MAGIC_SIZE, file) != MAGIC_SIZE) {
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+
+    /* flushed_at is relative to started_at, like the times compared with it */
+    started_at = clock_now_ns();
+    flushed_at = 0;
+    atexit(capture_stop);
+
+    log_print(INFO, "Capturing received frames to %s", path);
+
+    capture_enabled = true;
+
+    return true;
+}
+
+/* Frames from every reactor go through one buffered stream, flushed at most every FLUSH_NS so a killed server loses
+ * little of the capture without paying a write() per request */
+void capture_write(const byte *const data, const usize size) {
+    const uint_16 frame_size = (uint_16) (size > UINT16_MAX ? UINT16_MAX : size);
+    byte header[HEADER_SIZE];
+    uint_64 now;
+
+    pthread_mutex_lock(&file_mutex);
+
+    if (file != NULL) {
+        now = clock_now_ns() - started_at;
+
+        memcpy(header, &now, sizeof(uint_64));
+        memcpy(header + sizeof(uint_64), &frame_size, sizeof(uint_16));
+
+        if (fwrite(header, 1, HEADER_SIZE, file) != HEADER_SIZE || fwrite(data, 1, frame_size, file) != frame_size) {
+            log_error(ERROR, errno, "Failed to write capture, stopping it");
+            fclose(file);
+            file = NULL;
+            capture_enabled = false;
+        } else if (now - flushed_at > FLUSH_NS) {
+            fflush(file);
+            flushed_at = now;
+        }
+    }
+
+    pthread_mutex_unlock(&file_mutex);
+}
+
+void capture_stop(void) {
+    pthread_mutex_lock(&file_mutex);
+
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+
+    capture_enabled = false;
+
+    pthread_mutex_unlock(&file_mutex);
+}
+
+capture *capture_map(const char *const path) {
+    struct capture *capture;
+    struct stat status;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &status) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    if (status.st_size < MAGIC_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    map = mmap(NULL, (usize) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (memcmp(map, MAGIC, MAGIC_SIZE) != 0) {
+        munmap(map, (usize) status.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    capture = malloc(sizeof(struct capture));
+    capture->map = map;
+    capture->size = (usize) status.st_size;
+    capture->pos = MAGIC_SIZE;
+
+    return capture;
+}
+
+bool capture_next(capture *const capture, struct capture_frame *const frame) {
+    if (capture->size - capture->pos < HEADER_SIZE)
+        return false;
+
+    memcpy(&frame->offset_ns, capture->map + capture->pos, sizeof(uint_64));
+    memcpy(&frame->size, capture->map + capture->pos + sizeof(uint_64), sizeof(uint_16));
+
+    if (capture->size - capture->pos - HEADER_SIZE < frame->size)
+        return false;
+
+    frame->data = capture->map + capture->pos + HEADER_SIZE;
+    capture->pos += HEADER_SIZE + frame->size;
+
+    return true;
+}
+
+void capture_unmap(capture *const capture) {
+    munmap(capture->map, capture->size);
+    free(capture);
+}
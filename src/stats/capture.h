@@ -0,0 +1,31 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_CAPTURE_H
+#define CSOCKET_STATS_CAPTURE_H
+
+#include "types/primitive.h"
+
+/* A capture file is an 8 byte magic followed by one record per received frame, in host byte order:
+ * uint_64 nanoseconds since the capture started, uint_16 frame size, then the marshalled frame itself */
+struct capture_frame {
+    uint_64 offset_ns;
+    const byte *data;
+    uint_16 size;
+};
+
+typedef struct capture capture;
+
+extern bool capture_enabled;
+
+bool capture_start(const char *path);
+
+void capture_write(const byte *data, usize size);
+
+void capture_stop(void);
+
+capture *capture_map(const char *path);
+
+bool capture_next(capture *, struct capture_frame *);
+
+void capture_unmap(capture *);
+
+#endif /* CSOCKET_STATS_CAPTURE_H */
@@ -0,0 +1,68 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 199309L
+
+#include "clock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+bool clock_tsc = false;
+
+static double ns_per_tick = 1;
+
+uint_64 clock_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint_64) ts.tv_sec * 1000000000U + (uint_64) ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool tsc_is_stable(void) {
+    char line[4096];
+    bool constant = false, nonstop = false;
+    FILE *cpuinfo;
+
+    if (NULL == (cpuinfo = fopen("/proc/cpuinfo", "r")))
+        return false;
+
+    while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+        if (strncmp(line, "flags", 5) == 0) {
+            constant = strstr(line, " constant_tsc") != NULL;
+            nonstop = strstr(line, " nonstop_tsc") != NULL;
+            break;
+        }
+    }
+
+    fclose(cpuinfo);
+
+    return constant && nonstop;
+}
+#endif
+
+void clock_calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    const struct timespec delay = {.tv_sec = 0, .tv_nsec = 20000000};
+    uint_64 ns, ticks;
+
+    if (clock_tsc || !tsc_is_stable())
+        return;
+
+    ns = clock_now_ns();
+    ticks = __builtin_ia32_rdtsc();
+    nanosleep(&delay, NULL);
+    ticks = __builtin_ia32_rdtsc() - ticks;
+    ns = clock_now_ns() - ns;
+
+    if (ticks > 0) {
+        ns_per_tick = (double) ns / (double) ticks;
+        clock_tsc = true;
+    }
+#endif
+}
+
+uint_64 clock_ticks_to_ns(const uint_64 ticks) {
+    return clock_tsc ? (uint_64) ((double) ticks * ns_per_tick) : ticks;
+}
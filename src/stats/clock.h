@@ -0,0 +1,27 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_CLOCK_H
+#define CSOCKET_STATS_CLOCK_H
+
+#include "types/primitive.h"
+
+extern bool clock_tsc;
+
+uint_64 clock_now_ns(void);
+
+/* Takes 20 ms, so only --trace and --recorder pay for it: until then ticks are CLOCK_MONOTONIC ns. Must run before any
+ * thread takes a tick, as ticks of either kind cannot be compared */
+void clock_calibrate(void);
+
+uint_64 clock_ticks_to_ns(uint_64 ticks);
+
+/* Reads the TSC when clock_calibrate() found it invariant across cores and frequency changes, CLOCK_MONOTONIC otherwise */
+static __inline uint_64 clock_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (clock_tsc)
+        return __builtin_ia32_rdtsc();
+#endif
+
+    return clock_now_ns();
+}
+
+#endif /* CSOCKET_STATS_CLOCK_H */
@@ -0,0 +1,110 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "histogram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SUB_COUNT (1U << HISTOGRAM_SUB_BITS)
+#define SUB_HALF (1U << (HISTOGRAM_SUB_BITS - 1))
+#define VALUE_MAX ((((uint_64) 1) << HISTOGRAM_MAX_BITS) - 1)
+
+struct histogram *histogram_new(void) {
+    struct histogram *histogram = malloc(sizeof(struct histogram));
+
+    histogram_reset(histogram);
+
+    return histogram;
+}
+
+void histogram_destroy(struct histogram *const histogram) {
+    free(histogram);
+}
+
+void histogram_reset(struct histogram *const histogram) {
+    memset(histogram, 0, sizeof(struct histogram));
+    histogram->min = UINT64_MAX;
+}
+
+uint_32 histogram_bucket_index(uint_64 value) {
+    uint_32 shift;
+
+    if (value < SUB_COUNT)
+        return (uint_32) value;
+
+    if (value > VALUE_MAX)
+        value = VALUE_MAX;
+
+    shift = (uint_32) (63 - __builtin_clzll(value)) - (HISTOGRAM_SUB_BITS - 1);
+
+    return SUB_COUNT + (shift - 1) * SUB_HALF + (uint_32) (value >> shift) - SUB_HALF;
+}
+
+uint_64 histogram_bucket_lower(const uint_32 index) {
+    uint_32 shift;
+
+    if (index < SUB_COUNT)
+        return index;
+
+    shift = (index - SUB_COUNT) / SUB_HALF + 1;
+
+    return ((uint_64) ((index - SUB_COUNT) % SUB_HALF + SUB_HALF)) << shift;
+}
+
+uint_64 histogram_bucket_upper(const uint_32 index) {
+    if (index < SUB_COUNT)
+        return index;
+
+    return histogram_bucket_lower(index) + (((uint_64) 1) << ((index - SUB_COUNT) / SUB_HALF + 1)) - 1;
+}
+
+void histogram_record(struct histogram *const histogram, const uint_64 value) {
+    ++histogram->counts[histogram_bucket_index(value)];
+    ++histogram->count;
+    histogram->sum += value;
+
+    if (value < histogram->min)
+        histogram->min = value;
+
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+void histogram_merge(struct histogram *const dst, const struct histogram *const src) {
+    for (uint_32 i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        dst->counts[i] += src->counts[i];
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+
+    if (src->min < dst->min)
+        dst->min = src->min;
+
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint_64 histogram_percentile(const struct histogram *const histogram, const double percentile) {
+    uint_64 rank, seen = 0, value;
+
+    if (histogram->count == 0)
+        return 0;
+
+    rank = (uint_64) ((percentile / 100.0) * (double) histogram->count + 0.5);
+
+    if (rank < 1)
+        rank = 1;
+
+    for (uint_32 i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if ((seen += histogram->counts[i]) >= rank) {
+            value = histogram_bucket_upper(i);
+
+            return value > histogram->max ? histogram->max : (value < histogram->min ? histogram->min : value);
+        }
+    }
+
+    return histogram->max;
+}
+
+double histogram_mean(const struct histogram *const histogram) {
+    return histogram->count > 0 ? (double) histogram->sum / (double) histogram->count : 0;
+}
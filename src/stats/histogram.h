@@ -0,0 +1,42 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_HISTOGRAM_H
+#define CSOCKET_STATS_HISTOGRAM_H
+
+#include "types/primitive.h"
+
+/* Log-linear buckets: values below 2^HISTOGRAM_SUB_BITS are exact, every power of two above that is split
+ * into 2^(HISTOGRAM_SUB_BITS - 1) buckets, so that a bucket is at most 1/64 of its values wide, a relative error under
+ * 1.6%, up to 2^HISTOGRAM_MAX_BITS. */
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_MAX_BITS 48
+#define HISTOGRAM_BUCKETS ((1U << HISTOGRAM_SUB_BITS) + (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) * (1U << (HISTOGRAM_SUB_BITS - 1)))
+
+struct histogram {
+    uint_64 count;
+    uint_64 sum;
+    uint_64 min;
+    uint_64 max;
+    uint_64 counts[HISTOGRAM_BUCKETS];
+};
+
+struct histogram *histogram_new(void);
+
+void histogram_destroy(struct histogram *);
+
+void histogram_reset(struct histogram *);
+
+void histogram_record(struct histogram *, uint_64 value);
+
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+
+uint_64 histogram_percentile(const struct histogram *, double percentile);
+
+double histogram_mean(const struct histogram *);
+
+uint_32 histogram_bucket_index(uint_64 value);
+
+uint_64 histogram_bucket_lower(uint_32 index);
+
+uint_64 histogram_bucket_upper(uint_32 index);
+
+#endif /* CSOCKET_STATS_HISTOGRAM_H */
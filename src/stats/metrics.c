@@ -0,0 +1,281 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _DEFAULT_SOURCE
+
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "log.h"
+#include "trace.h"
+
+struct metrics_thread {
+    uint_64 counters[METRICS];
+    struct histogram latency;
+    struct metrics_thread *next;
+    pid_t owner;
+};
+
+/* Shared by the processes forked after metrics_share(): each of their threads claims a slot, and a dead process's slots
+ * are folded into the retired totals so that they can be claimed again */
+struct metrics_shared {
+    struct metrics_thread retired;
+    struct metrics_thread slots[METRICS_SHARED_MAX];
+};
+
+static struct metrics_thread *threads = NULL;
+
+static struct metrics_shared *shared = NULL;
+
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct metrics_thread *local = NULL;
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+
+static struct metrics_thread *thread_claim(void) {
+    const pid_t pid = getpid();
+    pid_t owner;
+
+    for (uint_16 i = 0; i < METRICS_SHARED_MAX; ++i) {
+        owner = 0;
+
+        if (__atomic_load_n(&shared->slots[i].owner, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&shared->slots[i].owner, &owner, pid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return &shared->slots[i];
+    }
+
+    log_print(WARN, "No shared metrics slot left, the metrics of this thread are not reported");
+
+    return NULL;
+}
+
+static struct metrics_thread *thread_register(void) {
+    struct metrics_thread *thread;
+
+    if (shared != NULL && NULL != (thread = thread_claim()))
+        return thread;
+
+    thread = calloc(1, sizeof(struct metrics_thread));
+    histogram_reset(&thread->latency);
+
+    pthread_mutex_lock(&threads_mutex);
+    thread->next = threads;
+    threads = thread;
+    pthread_mutex_unlock(&threads_mutex);
+
+    return thread;
+}
+
+/* Every counter has a single writer, its thread, so a relaxed load and store is enough and avoids a locked add */
+void metrics_add(const enum metric metric, const uint_64 value) {
+    uint_64 *counter;
+
+    if (local == NULL)
+        local = thread_register();
+
+    counter = &local->counters[metric];
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+void metrics_latency(const uint_64 ns) {
+    if (local == NULL)
+        local = thread_register();
+
+    histogram_record(&local->latency, ns);
+}
+
+static void thread_merge(uint_64 *const counters, struct histogram *const latency, const struct metrics_thread *const thread) {
+    for (uint_8 i = 0; i < METRICS; ++i)
+        counters[i] += __atomic_load_n(&thread->counters[i], __ATOMIC_RELAXED);
+
+    histogram_merge(latency, &thread->latency);
+}
+
+bool metrics_share(void) {
+    if (MAP_FAILED == (shared = mmap(NULL, sizeof(struct metrics_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))) {
+        shared = NULL;
+        return false;
+    }
+
+    histogram_reset(&shared->retired.latency);
+
+    for (uint_16 i = 0; i < METRICS_SHARED_MAX; ++i)
+        histogram_reset(&shared->slots[i].latency);
+
+    return true;
+}
+
+/* Only called once the process is gone, so that nothing writes to its slots anymore; its connections and queued requests
+ * went with it */
+void metrics_retire(const pid_t pid) {
+    struct metrics_thread *retired;
+
+    if (shared == NULL)
+        return;
+
+    retired = &shared->retired;
+
+    for (uint_16 i = 0; i < METRICS_SHARED_MAX; ++i) {
+        struct metrics_thread *slot = &shared->slots[i];
+
+        if (__atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE) != pid)
+            continue;
+
+        thread_merge(retired->counters, &retired->latency, slot);
+        memset(slot->counters, 0, sizeof(slot->counters));
+        histogram_reset(&slot->latency);
+        __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+    }
+
+    retired->counters[METRIC_CONNECTIONS_CLOSED] = retired->counters[METRIC_CONNECTIONS_OPENED];
+    retired->counters[METRIC_DEQUEUED] = retired->counters[METRIC_ENQUEUED];
+}
+
+void metrics_snapshot(uint_64 *const counters, struct histogram *const latency) {
+    struct metrics_thread *thread;
+
+    memset(counters, 0, sizeof(uint_64) * METRICS);
+    histogram_reset(latency);
+
+    if (shared != NULL) {
+        thread_merge(counters, latency, &shared->retired);
+
+        for (uint_16 i = 0; i < METRICS_SHARED_MAX; ++i) {
+            if (__atomic_load_n(&shared->slots[i].owner, __ATOMIC_ACQUIRE) != 0)
+                thread_merge(counters, latency, &shared->slots[i]);
+        }
+    }
+
+    pthread_mutex_lock(&threads_mutex);
+    thread = threads;
+    pthread_mutex_unlock(&threads_mutex);
+
+    for (; thread != NULL; thread = thread->next)
+        thread_merge(counters, latency, thread);
+}
+
+static void write_summary(FILE *const out, const char *const name, const char *const labels, const struct histogram *const h) {
+    for (uint_8 i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+        fprintf(out, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, *labels ? "," : "", quantiles[i],
+                (double) histogram_percentile(h, quantiles[i] * 100) / 1e9);
+
+    fprintf(out, "%s_sum%s%s%s %.9f\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", (double) h->sum / 1e9);
+    fprintf(out, "%s_count%s%s%s %lu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", (unsigned long) h->count);
+}
+
+void metrics_write(FILE *const out) {
+    uint_64 counters[METRICS];
+    struct histogram *histograms = malloc(sizeof(struct histogram) * (TRACE_STAGES + 1));
+    char labels[64];
+
+    metrics_snapshot(counters, &histograms[TRACE_STAGES]);
+
+    fprintf(out, "# TYPE csocket_requests_total counter\ncsocket_requests_total %lu\n", (unsigned long) counters[METRIC_REQUESTS]);
+    fprintf(out, "# TYPE csocket_received_bytes_total counter\ncsocket_received_bytes_total %lu\n", (unsigned long) counters[METRIC_BYTES_RECEIVED]);
+    fprintf(out, "# TYPE csocket_sent_bytes_total counter\ncsocket_sent_bytes_total %lu\n", (unsigned long) counters[METRIC_BYTES_SENT]);
+    fprintf(out, "# TYPE csocket_errors_total counter\ncsocket_errors_total %lu\n", (unsigned long) counters[METRIC_ERRORS]);
+    fprintf(out, "# TYPE csocket_shed_total counter\ncsocket_shed_total %lu\n", (unsigned long) counters[METRIC_SHED]);
+    fprintf(out, "# TYPE csocket_connections_total counter\ncsocket_connections_total %lu\n", (unsigned long) counters[METRIC_CONNECTIONS_OPENED]);
+    fprintf(out, "# TYPE csocket_connections_reaped_total counter\ncsocket_connections_reaped_total %lu\n", (unsigned long) counters[METRIC_CONNECTIONS_REAPED]);
+    fprintf(out, "# TYPE csocket_connections_paused_total counter\ncsocket_connections_paused_total %lu\n", (unsigned long) counters[METRIC_CONNECTIONS_PAUSED]);
+    fprintf(out, "# TYPE csocket_connections gauge\ncsocket_connections %ld\n",
+            (long) (counters[METRIC_CONNECTIONS_OPENED] - counters[METRIC_CONNECTIONS_CLOSED]));
+    fprintf(out, "# TYPE csocket_queue_depth gauge\ncsocket_queue_depth %ld\n",
+            (long) (counters[METRIC_ENQUEUED] - counters[METRIC_DEQUEUED]));
+
+    fprintf(out, "# TYPE csocket_cache_hits_total counter\ncsocket_cache_hits_total %lu\n", (unsigned long) counters[METRIC_CACHE_HITS]);
+    fprintf(out, "# TYPE csocket_cache_misses_total counter\ncsocket_cache_misses_total %lu\n", (unsigned long) counters[METRIC_CACHE_MISSES]);
+    fprintf(out, "# TYPE csocket_coalesced_total counter\ncsocket_coalesced_total %lu\n", (unsigned long) counters[METRIC_COALESCED]);
+
+    fprintf(out, "# TYPE csocket_request_latency_seconds summary\n");
+    write_summary(out, "csocket_request_latency_seconds", "", &histograms[TRACE_STAGES]);
+
+    if (trace_enabled) {
+        trace_snapshot(histograms);
+        fprintf(out, "# TYPE csocket_stage_latency_seconds summary\n");
+
+        for (uint_8 i = 0; i < TRACE_STAGES; ++i) {
+            snprintf(labels, sizeof(labels), "stage=\"%s\"", trace_stage_name((enum trace_stage) i));
+            write_summary(out, "csocket_stage_latency_seconds", labels, &histograms[i]);
+        }
+    }
+
+    free(histograms);
+}
+
+/* Every connection to the socket gets the current metrics in the Prometheus text format and is closed */
+void metrics_answer(const int server_fd) {
+    int client_fd;
+    FILE *out;
+
+    if ((client_fd = accept(server_fd, NULL, NULL)) < 0)
+        return;
+
+    if (NULL == (out = fdopen(client_fd, "w"))) {
+        close(client_fd);
+        return;
+    }
+
+    metrics_write(out);
+    fclose(out);
+}
+
+static __attribute__((noreturn)) void *serve(void *const arg) {
+    int server_fd = *((int *) arg);
+
+    free(arg);
+
+    for (;;)
+        metrics_answer(server_fd);
+}
+
+int metrics_listen(const char *const socket_path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int server_fd;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(server_fd, 16) < 0) {
+        close(server_fd);
+        return -1;
+    }
+
+    log_print(INFO, "Serving metrics on %s", socket_path);
+
+    return server_fd;
+}
+
+bool metrics_serve(const char *const socket_path) {
+    pthread_t thread;
+    int *server_fd = malloc(sizeof(int));
+
+    if ((*server_fd = metrics_listen(socket_path)) < 0) {
+        free(server_fd);
+        return false;
+    }
+
+    if ((errno = pthread_create(&thread, NULL, serve, server_fd)) != 0) {
+        close(*server_fd);
+        free(server_fd);
+        return false;
+    }
+
+    pthread_detach(thread);
+
+    return true;
+}
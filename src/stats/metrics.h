@@ -0,0 +1,53 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_METRICS_H
+#define CSOCKET_STATS_METRICS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types/primitive.h"
+#include "histogram.h"
+
+/* Threads of all the processes sharing the metrics that may report at the same time */
+#define METRICS_SHARED_MAX 256
+
+enum metric {
+    METRIC_REQUESTS,
+    METRIC_BYTES_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_ERRORS,
+    METRIC_SHED,
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_CONNECTIONS_REAPED,
+    METRIC_CONNECTIONS_PAUSED,
+    METRIC_ENQUEUED,
+    METRIC_DEQUEUED,
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_COALESCED,
+    METRICS
+};
+
+void metrics_add(enum metric, uint_64 value);
+
+void metrics_latency(uint_64 ns);
+
+void metrics_snapshot(uint_64 *counters, struct histogram *latency);
+
+void metrics_write(FILE *);
+
+/* Called before forking, makes every process forked afterwards report to the same metrics, which any of them snapshots */
+bool metrics_share(void);
+
+/* Folds the metrics of a dead process into the totals, freeing the room its threads took */
+void metrics_retire(pid_t);
+
+/* Serves the metrics from a thread of its own */
+bool metrics_serve(const char *socket_path);
+
+/* Or from the caller's loop: metrics_answer() serves one connection once the socket is readable */
+int metrics_listen(const char *socket_path);
+
+void metrics_answer(int server_fd);
+
+#endif /* CSOCKET_STATS_METRICS_H */
@@ -0,0 +1,206 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "log.h"
+
+struct slot {
+    uint_64 seq;
+    struct recorder_entry entry;
+};
+
+static const char *const outcome_names[] = {"ok", "bad_request", "no_method", "no_reply", "send_failed", "expired"};
+
+bool recorder_enabled = false;
+
+static struct slot *slots = NULL;
+
+static uint_32 slots_count = 4096;
+
+static uint_64 next_seq = 0;
+
+static uint_64 threshold_ns = 0;
+
+static uint_64 last_dump_at = 0;
+
+static const char *output_path = NULL;
+
+static uint_16 threads_count = 0;
+
+static __thread uint_16 thread_id = 0;
+
+/* ENTRIES[:threshold=USEC,file=PATH] */
+bool recorder_parse(const char *const spec) {
+    static char buffer[256];
+    char *option, *value, *endptr, *saveptr = NULL;
+    long number;
+
+    if (strlen(spec) >= sizeof(buffer))
+        return false;
+
+    strcpy(buffer, spec);
+
+    if (NULL != (option = strchr(buffer, ':')))
+        *option++ = '\0';
+
+    number = strtol(buffer, &endptr, 10);
+    if (*endptr != '\0' || endptr == buffer || number <= 0 || number > 1048576)
+        return false;
+
+    slots_count = (uint_32) number;
+
+    for (option = option ? strtok_r(option, ",", &saveptr) : NULL; option != NULL; option = strtok_r(NULL, ",", &saveptr)) {
+        if (NULL == (value = strchr(option, '=')))
+            return false;
+
+        *value++ = '\0';
+
+        if (strcmp(option, "threshold") == 0) {
+            number = strtol(value, &endptr, 10);
+            if (*endptr != '\0' || endptr == value || number <= 0)
+                return false;
+
+            threshold_ns = (uint_64) number * 1000U;
+        } else if (strcmp(option, "file") == 0 && *value != '\0')
+            output_path = value;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+/* Entries are claimed with a fetch-and-add and published by their sequence number, so readers can tell a slot that
+ * is being rewritten from one that is complete */
+void recorder_add(const struct recorder_entry *const entry) {
+    uint_64 seq = __atomic_add_fetch(&next_seq, 1, __ATOMIC_RELAXED), total;
+    struct slot *slot = &slots[seq % slots_count];
+
+    if (thread_id == 0)
+        thread_id = __atomic_add_fetch(&threads_count, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->entry = *entry;
+    slot->entry.thread = thread_id;
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+
+    if (threshold_ns > 0 && (total = clock_ticks_to_ns(entry->stages[TRACE_TOTAL])) > threshold_ns) {
+        uint_64 now = clock_now_ns(), last = __atomic_load_n(&last_dump_at, __ATOMIC_RELAXED);
+
+        if (now - last > 1000000000U && __atomic_compare_exchange_n(&last_dump_at, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            log_print(WARN, "Request took %.3f ms, dumping the flight recorder", (double) total / 1e6);
+            kill(getpid(), SIGUSR2);
+        }
+    }
+}
+
+static int compare_slots(const void *const a, const void *const b) {
+    const uint_64 seq_a = ((const struct slot *) a)->seq, seq_b = ((const struct slot *) b)->seq;
+
+    return seq_a < seq_b ? -1 : (seq_a > seq_b);
+}
+
+void recorder_dump(void) {
+    struct slot *copy = malloc(sizeof(struct slot) * slots_count);
+    const uint_64 now = clock_ticks();
+    uint_32 count = 0;
+    char client[INET_ADDRSTRLEN];
+    struct in_addr address;
+    FILE *out = stderr;
+
+    for (uint_32 i = 0; i < slots_count; ++i) {
+        uint_64 seq = __atomic_load_n(&slots[i].seq, __ATOMIC_ACQUIRE);
+
+        if (seq == 0)
+            continue;
+
+        copy[count].entry = slots[i].entry;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slots[i].seq, __ATOMIC_RELAXED) == seq)
+            copy[count++].seq = seq;
+    }
+
+    qsort(copy, count, sizeof(struct slot), compare_slots);
+
+    if (output_path != NULL && NULL == (out = fopen(output_path, "a"))) {
+        log_error(ERROR, errno, "%s: failed to open flight recorder output", output_path);
+        out = stderr;
+    }
+
+    fprintf(out, "# flight recorder: %u requests, times in µs\n", count);
+    fprintf(out, "%10s %10s %3s %-21s %-10s %5s %5s %-11s", "seq", "age", "thr", "client", "method", "req", "rep", "outcome");
+
+    for (uint_8 s = 0; s < TRACE_STAGES; ++s)
+        fprintf(out, " %10s", trace_stage_name((enum trace_stage) s));
+
+    fprintf(out, "\n");
+
+    for (uint_32 i = 0; i < count; ++i) {
+        const struct recorder_entry *e = &copy[i].entry;
+
+        address.s_addr = e->client_ip;
+        inet_ntop(AF_INET, &address, client, sizeof(client));
+
+        fprintf(out, "%10lu %10.1f %3u %15s:%-5u %-10s %5u %5u %-11s", (unsigned long) copy[i].seq,
+                (double) clock_ticks_to_ns(now > e->received_at ? now - e->received_at : 0) / 1000.0, e->thread, client,
+                e->client_port, e->method, e->request_size, e->reply_size, outcome_names[e->outcome]);
+
+        for (uint_8 s = 0; s < TRACE_STAGES; ++s)
+            fprintf(out, " %10.3f", (double) clock_ticks_to_ns(e->stages[s]) / 1000.0);
+
+        fprintf(out, "\n");
+    }
+
+    fflush(out);
+
+    if (out != stderr)
+        fclose(out);
+
+    free(copy);
+}
+
+static __attribute__((noreturn)) void *dump_on_signal(void *const arg) {
+    sigset_t *signals = arg;
+    int signal;
+
+    for (;;) {
+        if (sigwait(signals, &signal) == 0)
+            recorder_dump();
+    }
+}
+
+/* Must run before any other thread is started, so that every thread inherits the blocked SIGUSR2 */
+void recorder_enable(void) {
+    static sigset_t signals;
+    pthread_t thread;
+    int err;
+
+    clock_calibrate();
+
+    slots = calloc(slots_count, sizeof(struct slot));
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if ((err = pthread_create(&thread, NULL, dump_on_signal, &signals)) != 0)
+        die(EXIT_FAILURE, err, "Failed to start flight recorder thread");
+
+    pthread_detach(thread);
+
+    log_print(INFO, "Recording the last %u requests, send SIGUSR2 to dump them", slots_count);
+
+    recorder_enabled = true;
+    trace_timing = true;
+}
@@ -0,0 +1,39 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_RECORDER_H
+#define CSOCKET_STATS_RECORDER_H
+
+#include "types/primitive.h"
+#include "trace.h"
+
+enum recorder_outcome {
+    RECORDER_OK,
+    RECORDER_BAD_REQUEST,
+    RECORDER_NO_METHOD,
+    RECORDER_NO_REPLY,
+    RECORDER_SEND_FAILED,
+    RECORDER_EXPIRED
+};
+
+struct recorder_entry {
+    uint_64 received_at;
+    uint_64 stages[TRACE_STAGES];
+    char method[16];
+    uint_32 request_size;
+    uint_32 reply_size;
+    uint_32 client_ip;
+    uint_16 client_port;
+    uint_16 thread;
+    enum recorder_outcome outcome;
+};
+
+extern bool recorder_enabled;
+
+bool recorder_parse(const char *spec);
+
+void recorder_enable(void);
+
+void recorder_add(const struct recorder_entry *);
+
+void recorder_dump(void);
+
+#endif /* CSOCKET_STATS_RECORDER_H */
@@ -0,0 +1,124 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include "log.h"
+
+struct trace_thread {
+    struct histogram stages[TRACE_STAGES];
+    struct trace_thread *next;
+};
+
+static const char *const stage_names[TRACE_STAGES] = {
+        "receive", "enqueue", "queue", "unmarshall", "acquire", "execute", "marshall", "send", "total"
+};
+
+bool trace_enabled = false;
+
+bool trace_timing = false;
+
+static struct trace_thread *threads = NULL;
+
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct trace_thread *local = NULL;
+
+static struct trace_thread *thread_register(void) {
+    struct trace_thread *thread = malloc(sizeof(struct trace_thread));
+
+    for (uint_8 i = 0; i < TRACE_STAGES; ++i)
+        histogram_reset(&thread->stages[i]);
+
+    pthread_mutex_lock(&threads_mutex);
+    thread->next = threads;
+    threads = thread;
+    pthread_mutex_unlock(&threads_mutex);
+
+    return thread;
+}
+
+void trace_record(const enum trace_stage stage, const uint_64 begin, const uint_64 end) {
+    if (!trace_enabled || begin == 0 || end < begin)
+        return;
+
+    if (local == NULL)
+        local = thread_register();
+
+    histogram_record(&local->stages[stage], clock_ticks_to_ns(end - begin));
+}
+
+const char *trace_stage_name(const enum trace_stage stage) {
+    return stage_names[stage];
+}
+
+void trace_snapshot(struct histogram *const stages) {
+    struct trace_thread *thread;
+
+    for (uint_8 i = 0; i < TRACE_STAGES; ++i)
+        histogram_reset(&stages[i]);
+
+    pthread_mutex_lock(&threads_mutex);
+    thread = threads;
+    pthread_mutex_unlock(&threads_mutex);
+
+    for (; thread != NULL; thread = thread->next) {
+        for (uint_8 i = 0; i < TRACE_STAGES; ++i)
+            histogram_merge(&stages[i], &thread->stages[i]);
+    }
+}
+
+void trace_dump(FILE *const out) {
+    struct histogram *stages = malloc(sizeof(struct histogram) * TRACE_STAGES);
+
+    trace_snapshot(stages);
+
+    fprintf(out, "%-11s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean_us", "p50_us", "p99_us", "p99.9_us", "max_us");
+
+    for (uint_8 i = 0; i < TRACE_STAGES; ++i) {
+        fprintf(out, "%-11s %10lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", stage_names[i], (unsigned long) stages[i].count,
+                histogram_mean(&stages[i]) / 1000.0, (double) histogram_percentile(&stages[i], 50) / 1000.0,
+                (double) histogram_percentile(&stages[i], 99) / 1000.0, (double) histogram_percentile(&stages[i], 99.9) / 1000.0,
+                (double) stages[i].max / 1000.0);
+    }
+
+    fflush(out);
+    free(stages);
+}
+
+static __attribute__((noreturn)) void *dump_on_signal(void *const arg) {
+    sigset_t *signals = arg;
+    int signal;
+
+    for (;;) {
+        if (sigwait(signals, &signal) == 0)
+            trace_dump(stderr);
+    }
+}
+
+/* Must run before any other thread is started, so that every thread inherits the blocked SIGUSR1 */
+void trace_enable(void) {
+    static sigset_t signals;
+    pthread_t thread;
+    int err;
+
+    clock_calibrate();
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if ((err = pthread_create(&thread, NULL, dump_on_signal, &signals)) != 0)
+        die(EXIT_FAILURE, err, "Failed to start trace thread");
+
+    pthread_detach(thread);
+
+    log_print(INFO, "Tracing request stages with %s, send SIGUSR1 to dump them", clock_tsc ? "TSC" : "CLOCK_MONOTONIC");
+
+    trace_enabled = true;
+    trace_timing = true;
+}
@@ -0,0 +1,51 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_STATS_TRACE_H
+#define CSOCKET_STATS_TRACE_H
+
+#include <stdio.h>
+#include "types/primitive.h"
+#include "clock.h"
+#include "histogram.h"
+
+enum trace_stage {
+    TRACE_RECEIVE,
+    TRACE_ENQUEUE,
+    TRACE_QUEUE,
+    TRACE_UNMARSHALL,
+    TRACE_ACQUIRE,
+    TRACE_EXECUTE,
+    TRACE_MARSHALL,
+    TRACE_SEND,
+    TRACE_TOTAL,
+    TRACE_STAGES
+};
+
+extern bool trace_enabled;
+
+extern bool trace_timing;
+
+/* Timestamp for trace_record(), 0 while neither tracing nor the flight recorder need it so the hooks cost one branch */
+static __inline uint_64 trace_now(void) {
+    return trace_timing ? clock_ticks() : 0;
+}
+
+void trace_enable(void);
+
+void trace_record(enum trace_stage, uint_64 begin, uint_64 end);
+
+/* Records the time elapsed since *since into the stage histogram and stages[stage], and moves *since forward */
+static __inline void trace_lap(const enum trace_stage stage, uint_64 *const since, uint_64 *const stages) {
+    const uint_64 now = trace_now();
+
+    trace_record(stage, *since, now);
+    stages[stage] = now - *since;
+    *since = now;
+}
+
+const char *trace_stage_name(enum trace_stage);
+
+void trace_snapshot(struct histogram *stages);
+
+void trace_dump(FILE *);
+
+#endif /* CSOCKET_STATS_TRACE_H */
@@ -0,0 +1,157 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _GNU_SOURCE
+
+#include "supervisor.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "log.h"
+#include "stats/clock.h"
+#include "stats/metrics.h"
+
+#define RESTART_DELAY_MIN_NS 100000000ULL
+#define RESTART_DELAY_MAX_NS 5000000000ULL
+#define CRASH_LOOP_NS 1000000000ULL
+
+struct worker {
+    pid_t pid;
+    uint_64 started_at;
+    uint_64 restart_at;
+    uint_64 delay_ns;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(const int signum) {
+    if (signum != SIGCHLD)
+        stopping = 1;
+}
+
+/* Returns true in the new worker, which gets the signal dispositions and mask the supervisor started with */
+static bool spawn(struct worker *const worker, const uint_8 number, const int stats_fd, const sigset_t *const mask) {
+    const pid_t supervisor = getpid();
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        log_error(WARN, errno, "Failed to fork worker %u", number);
+        worker->restart_at = clock_now_ns() + RESTART_DELAY_MIN_NS;
+        return false;
+    } else if (pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        sigprocmask(SIG_SETMASK, mask, NULL);
+
+        if (stats_fd >= 0)
+            close(stats_fd);
+
+        /* a worker does not outlive its supervisor, as nothing could restart nor stop it anymore */
+        if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0 || getppid() != supervisor)
+            exit(EXIT_FAILURE);
+
+        return true;
+    }
+
+    worker->pid = pid;
+    worker->started_at = clock_now_ns();
+    log_print(INFO, "Worker %u running with pid %d", number, (int) pid);
+
+    return false;
+}
+
+/* A worker that dies within CRASH_LOOP_NS of starting waits twice as long as the last time before it is restarted */
+static void reap(struct worker *const workers, const uint_8 workers_num) {
+    uint_64 now;
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (uint_8 i = 0; i < workers_num; ++i) {
+            if (workers[i].pid != pid)
+                continue;
+
+            if (WIFSIGNALED(status))
+                log_print(WARN, "Worker %u with pid %d killed by signal %d", i, (int) pid, WTERMSIG(status));
+            else
+                log_print(WARN, "Worker %u with pid %d exited with status %d", i, (int) pid, WEXITSTATUS(status));
+
+            metrics_retire(pid);
+
+            now = clock_now_ns();
+            workers[i].pid = 0;
+            workers[i].delay_ns = now - workers[i].started_at >= CRASH_LOOP_NS ? 0 :
+                                  workers[i].delay_ns == 0 ? RESTART_DELAY_MIN_NS :
+                                  workers[i].delay_ns * 2 < RESTART_DELAY_MAX_NS ? workers[i].delay_ns * 2 : RESTART_DELAY_MAX_NS;
+            workers[i].restart_at = now + workers[i].delay_ns;
+        }
+    }
+}
+
+static __attribute__((noreturn)) void stop(const struct worker *const workers, const uint_8 workers_num) {
+    log_print(INFO, "Stopping workers");
+
+    for (uint_8 i = 0; i < workers_num; ++i) {
+        if (workers[i].pid > 0)
+            kill(workers[i].pid, SIGTERM);
+    }
+
+    while (wait(NULL) > 0 || errno == EINTR)
+        continue;
+
+    exit(EXIT_SUCCESS);
+}
+
+uint_8 supervise(const uint_8 workers_num, const char *const stats_path) {
+    struct worker *workers = calloc(workers_num, sizeof(struct worker));
+    struct sigaction action = {.sa_handler = on_signal};
+    struct pollfd stats = {.fd = -1, .events = POLLIN};
+    struct timespec timeout;
+    sigset_t blocked, original;
+    uint_64 now, wait_ns;
+
+    if (stats_path != NULL && (!metrics_share() || (stats.fd = metrics_listen(stats_path)) < 0))
+        die(EXIT_FAILURE, errno, "%s: failed to serve metrics", stats_path);
+
+    /* only delivered while waiting in ppoll(), so that no child exit nor stop request slips in before it */
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGTERM);
+    sigaddset(&blocked, SIGINT);
+    sigprocmask(SIG_BLOCK, &blocked, &original);
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    for (;;) {
+        reap(workers, workers_num);
+
+        if (stopping)
+            stop(workers, workers_num);
+
+        now = clock_now_ns();
+        wait_ns = UINT64_MAX;
+
+        for (uint_8 i = 0; i < workers_num; ++i) {
+            if (workers[i].pid == 0 && workers[i].restart_at <= now && spawn(&workers[i], i, stats.fd, &original)) {
+                free(workers);
+                return i;
+            }
+
+            /* either running now or, when the fork failed, due later */
+            if (workers[i].pid == 0 && workers[i].restart_at - now < wait_ns)
+                wait_ns = workers[i].restart_at - now;
+        }
+
+        timeout.tv_sec = (time_t) (wait_ns / 1000000000U);
+        timeout.tv_nsec = (long) (wait_ns % 1000000000U);
+
+        if (ppoll(&stats, stats.fd >= 0, wait_ns != UINT64_MAX ? &timeout : NULL, &original) > 0 && (stats.revents & POLLIN))
+            metrics_answer(stats.fd);
+    }
+}
@@ -0,0 +1,12 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_SUPERVISOR_H
+#define CSOCKET_SUPERVISOR_H
+
+#include "types/primitive.h"
+
+/* Forks workers_num worker processes and returns in each of them with its number, never in the supervisor: it restarts
+ * the workers that die, with a growing delay while they keep dying right away, serves the metrics of them all on
+ * stats_path when given, and stops them when it is told to stop itself */
+uint_8 supervise(uint_8 workers_num, const char *stats_path);
+
+#endif /* CSOCKET_SUPERVISOR_H */
@@ -0,0 +1,41 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "test.h"
+
+#include "bm/c10k.h"
+
+static bool near(const double a, const double b) {
+    return a - b < 1e-9 && b - a < 1e-9;
+}
+
+static void c10k_spec(void) {
+    struct c10k_options options;
+
+    /* a spec without options used to hand strtok_r() a NULL string on its first call */
+    CHECK(c10k_parse("1000", &options));
+    CHECK(options.connections == 1000 && options.step == 100 && near(options.rate, 1) && options.duration == 5);
+    CHECK(options.server_pid == 0);
+
+    CHECK(c10k_parse("5", &options));
+    CHECK(options.connections == 5 && options.step == 5);
+
+    CHECK(c10k_parse("1000:", &options));
+    CHECK(options.connections == 1000 && options.step == 100);
+
+    CHECK(c10k_parse("2000:step=500,rate=2.5,duration=3,pid=42", &options));
+    CHECK(options.connections == 2000 && options.step == 500 && near(options.rate, 2.5) && options.duration == 3);
+    CHECK(options.server_pid == 42);
+
+    CHECK(c10k_parse("300:duration=1", &options));
+    CHECK(options.connections == 300 && options.step == 30 && options.duration == 1);
+
+    CHECK(!c10k_parse("", &options));
+    CHECK(!c10k_parse("0", &options));
+    CHECK(!c10k_parse("abc", &options));
+    CHECK(!c10k_parse("1000:step", &options));
+    CHECK(!c10k_parse("1000:step=0", &options));
+    CHECK(!c10k_parse("1000:speed=2", &options));
+}
+
+void test_bm(void) {
+    c10k_spec();
+}
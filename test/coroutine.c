@@ -0,0 +1,107 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "test.h"
+
+#include <pthread.h>
+#include "i/invoker.h"
+#include "i/service.h"
+#include "np/types.h"
+#include "r/requestor.h"
+#include "stats/clock.h"
+
+#define CALC_PORT 39261
+#define RELAY_PORT 39262
+
+static struct host_addr calc_addr = {.service_name = "calc", .protocol = TCP, .address = "127.0.0.1", .port = CALC_PORT};
+
+/* Calls calc.delay(a, b) on the other server, which gives the scheduler up for b ms inside rh_receive_from_server() */
+static void relay(const data *const d, data *const r) {
+    struct requestor *requestor;
+    struct data *reply = NULL;
+
+    if (NULL == (requestor = requestor_new(&calc_addr)))
+        return;
+
+    if (requestor_invoke(requestor, "delay", d, &reply)) {
+        data_push(r, INT, sizeof(int_32), data_get_value(reply, 0)->value);
+        data_destroy(reply);
+    }
+
+    requestor_destroy(requestor);
+}
+
+static void add(const data *const d, data *const r) {
+    const int_32 result = *(uint_16 *) data_get_value(d, 0)->value + *(uint_16 *) data_get_value(d, 1)->value;
+
+    data_push(r, INT, sizeof(int_32), &result);
+}
+
+static __attribute__((noreturn)) void *run(void *const instances_num) {
+    struct service *service = service_new("calc", 2, (uint_8) (usize) instances_num);
+    struct invoker *invoker = invoker_new(TCP, RELAY_PORT + (uint_16) (usize) instances_num, NULL, 1, 0, true);
+
+    service_add_method(service, "relay", relay, 0);
+    service_add_method(service, "add", add, 0);
+
+    invoker_run(invoker, service);
+}
+
+static void start_relay(const uint_8 instances_num) {
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, run, (void *) (usize) instances_num);
+    pthread_detach(thread);
+}
+
+/* A single scheduler answers the add while the relay waits on its outbound call, so the relay must have yielded */
+static void yield_on_call(void) {
+    const uint_16 port = RELAY_PORT + 2;
+    rh_conn_ctx *slow = test_connect(TCP, "127.0.0.1", port), *fast = test_connect(TCP, "127.0.0.1", port);
+    uint_64 begin = clock_now_ns();
+    int_32 result = 0;
+
+    if (!CHECK(slow != NULL && fast != NULL))
+        return;
+
+    CHECK(test_call(slow, "relay", 5, 200));
+    CHECK(test_call(fast, "add", 2, 3));
+
+    CHECK(test_reply(fast, &result) && result == 5);
+    CHECK(clock_now_ns() - begin < 200000000U);
+
+    result = 0;
+    CHECK(test_reply(slow, &result) && result == 5);
+    CHECK(clock_now_ns() - begin >= 200000000U);
+
+    rh_client_destroy(slow);
+    rh_client_destroy(fast);
+}
+
+/* With a single instance the second relay parks until the first releases it, then runs */
+static void park_for_instance(void) {
+    const uint_16 port = RELAY_PORT + 1;
+    rh_conn_ctx *first = test_connect(TCP, "127.0.0.1", port), *second = test_connect(TCP, "127.0.0.1", port);
+    uint_64 begin = clock_now_ns();
+    int_32 result = 0;
+
+    if (!CHECK(first != NULL && second != NULL))
+        return;
+
+    CHECK(test_call(first, "relay", 1, 100));
+    CHECK(test_call(second, "relay", 2, 100));
+
+    CHECK(test_reply(first, &result) && result == 1);
+    CHECK(test_reply(second, &result) && result == 2);
+    CHECK(clock_now_ns() - begin >= 200000000U);
+
+    rh_client_destroy(first);
+    rh_client_destroy(second);
+}
+
+void test_coroutine(void) {
+    test_server(TCP, CALC_PORT, NULL, 1, false);
+    start_relay(1);
+    start_relay(2);
+
+    yield_on_call();
+    park_for_instance();
+}
@@ -0,0 +1,106 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "test.h"
+
+#include <time.h>
+#include <errno.h>
+#include "r/requestor.h"
+#include "stats/clock.h"
+#include "stats/metrics.h"
+
+#define TEST_PORT 39251
+
+static void metrics_completed(uint_64 *const completed) {
+    static struct histogram latency;
+    uint_64 counters[METRICS];
+
+    metrics_snapshot(counters, &latency);
+    *completed = counters[METRIC_REQUESTS] + counters[METRIC_ERRORS];
+}
+
+/* With a single worker, the add is only answered before the delay if the worker was let go once delay returned */
+static void async_reply(void) {
+    rh_conn_ctx *slow = test_connect(TCP, "127.0.0.1", TEST_PORT), *fast = test_connect(TCP, "127.0.0.1", TEST_PORT);
+    uint_64 begin = clock_now_ns();
+    int_32 result = 0;
+
+    if (!CHECK(slow != NULL && fast != NULL))
+        return;
+
+    CHECK(test_call(slow, "delay", 7, 200));
+    CHECK(test_call(fast, "add", 1, 2));
+
+    CHECK(test_reply(fast, &result) && result == 3);
+    CHECK(clock_now_ns() - begin < 200000000U);
+
+    CHECK(test_reply(slow, &result) && result == 7);
+    CHECK(clock_now_ns() - begin >= 200000000U);
+
+    rh_client_destroy(slow);
+    rh_client_destroy(fast);
+}
+
+/* The reply finds its connection gone: it is dropped, and the server goes on serving the others */
+static void async_reply_after_close(void) {
+    const struct timespec wait = {.tv_sec = 0, .tv_nsec = 300000000};
+    rh_conn_ctx *gone = test_connect(TCP, "127.0.0.1", TEST_PORT), *conn_ctx;
+    uint_64 before, after;
+    int_32 result = 0;
+
+    if (!CHECK(gone != NULL))
+        return;
+
+    metrics_completed(&before);
+    CHECK(test_call(gone, "delay", 9, 100));
+    rh_client_destroy(gone);
+
+    nanosleep(&wait, NULL);
+    metrics_completed(&after);
+    CHECK(after == before + 1);
+
+    if (!CHECK(NULL != (conn_ctx = test_connect(TCP, "127.0.0.1", TEST_PORT))))
+        return;
+
+    CHECK(test_call(conn_ctx, "mul", 6, 7));
+    CHECK(test_reply(conn_ctx, &result) && result == 42);
+
+    rh_client_destroy(conn_ctx);
+}
+
+/* A deadline of 1 µs is gone before any worker gets to the request: the server sheds it and the requestor says so,
+ * whatever errno held before */
+static void deadline_exceeded(void) {
+    struct host_addr calc_addr = {.service_name = "calc", .protocol = TCP, .address = "127.0.0.1", .port = TEST_PORT};
+    const uint_16 a = 1, b = 2;
+    struct requestor *requestor;
+    struct data *request = data_new(2), *reply = NULL;
+
+    data_push(request, UINT, sizeof(uint_16), &a);
+    data_push(request, UINT, sizeof(uint_16), &b);
+
+    if (CHECK(NULL != (requestor = requestor_new(&calc_addr)))) {
+        requestor_set_deadline(requestor, 1);
+        errno = 0;
+        CHECK(!requestor_invoke(requestor, "add", request, &reply) && reply == NULL && errno == ETIMEDOUT);
+
+        requestor_set_deadline(requestor, 0);
+        errno = ETIMEDOUT;
+        CHECK(requestor_invoke(requestor, "add", request, &reply) && reply != NULL);
+
+        if (reply != NULL)
+            data_destroy(reply);
+
+        requestor_destroy(requestor);
+    }
+
+    data_destroy(request);
+}
+
+void test_invoker(void) {
+    test_server(TCP, TEST_PORT, NULL, 1, false);
+
+    async_reply();
+    async_reply_after_close();
+    deadline_exceeded();
+}
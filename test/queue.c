@@ -0,0 +1,103 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#include "test.h"
+
+#include "i/queue.h"
+
+#define FLOOD 1000
+
+static struct queue_entry entries[FLOOD + 1];
+
+static struct queue_entry *entry(const usize i, const uint_64 flow, const uint_8 lane, const uint_8 weight) {
+    entries[i] = (struct queue_entry) {.flow = flow, .lane = lane, .weight = weight};
+
+    return &entries[i];
+}
+
+/* How many pops it took to get the entry, or limit + 1 when it did not come out of the first limit pops */
+static usize pops_until(struct queue *const queue, const struct queue_entry *const target, const usize limit) {
+    for (usize pops = 1; pops <= limit; ++pops) {
+        if (queue_pop(queue) == target)
+            return pops;
+    }
+
+    return limit + 1;
+}
+
+static void drain(struct queue *const queue, usize count) {
+    while (count-- > 0)
+        queue_pop(queue);
+}
+
+/* A connection that floods the queue delays another one's request by a single turn, not by its backlog */
+static void flood_fairness(void) {
+    struct queue *queue = queue_new();
+    struct queue_entry *other = entry(FLOOD, 2, 0, 1);
+    usize pops;
+
+    for (usize i = 0; i < FLOOD; ++i)
+        queue_push(queue, entry(i, 1, 0, 1));
+
+    queue_push(queue, other);
+
+    CHECK((pops = pops_until(queue, other, FLOOD)) <= 2);
+
+    drain(queue, FLOOD + 1 - pops);
+    queue_destroy(queue);
+}
+
+/* A flow whose requests weigh 4 gets a quarter of the pops of one whose requests weigh 1 */
+static void weighted_flows(void) {
+    struct queue *queue = queue_new();
+    usize heavy = 0;
+
+    for (usize i = 0; i < FLOOD / 2; ++i) {
+        queue_push(queue, entry(i * 2, 1, 0, 4));
+        queue_push(queue, entry(i * 2 + 1, 2, 0, 1));
+    }
+
+    for (usize i = 0; i < 100; ++i)
+        heavy += queue_pop(queue)->flow == 1;
+
+    CHECK(heavy >= 18 && heavy <= 22);
+
+    drain(queue, FLOOD - 100);
+    queue_destroy(queue);
+}
+
+/* The high lane drains first, pushed last or not, but hands one in QUEUE_PASS_MAX pops to the lower lane */
+static void lanes_priority(void) {
+    struct queue *queue = queue_new();
+    struct queue_entry *low = entry(FLOOD, 1, 0, 1);
+    bool high_first = true;
+    usize pops;
+
+    for (usize i = 0; i < 10; ++i)
+        queue_push(queue, entry(i, 1, 0, 1));
+
+    for (usize i = 10; i < 20; ++i)
+        queue_push(queue, entry(i, 2, QUEUE_LANES - 1, 1));
+
+    for (usize i = 0; i < 10; ++i)
+        high_first = high_first && queue_pop(queue)->lane == QUEUE_LANES - 1;
+
+    CHECK(high_first);
+    CHECK(queue_pop(queue)->lane == 0);
+
+    drain(queue, 9);
+
+    for (usize i = 0; i < FLOOD; ++i)
+        queue_push(queue, entry(i, 2, QUEUE_LANES - 1, 1));
+
+    queue_push(queue, low);
+
+    CHECK((pops = pops_until(queue, low, FLOOD)) == QUEUE_PASS_MAX);
+
+    drain(queue, FLOOD + 1 - pops);
+    queue_destroy(queue);
+}
+
+void test_queue(void) {
+    flood_fairness();
+    weighted_flows();
+    lanes_priority();
+}
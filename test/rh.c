@@ -0,0 +1,344 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _GNU_SOURCE
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "rh/server.h"
+#include "rh/shm.h"
+#include "m/marshaller.h"
+#include "stats/clock.h"
+#include "stats/metrics.h"
+
+#define SHM_PATH "/tmp/csocket-test-shm.sock"
+#define UNIX_PATH "/tmp/csocket-test-unix.sock"
+#define PIPELINED 20000
+#define TCP_PORT 39271
+#define IDLE_TIMEOUT_S 1
+#define CLOSED_PORT 39279
+
+static int unix_connect(const char *const path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    strcpy(address.sun_path, path);
+
+    if (socket_fd >= 0 && connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+static int tcp_connect(const uint_16 port) {
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (socket_fd >= 0 && connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+static uint_64 metric(const enum metric which) {
+    static struct histogram latency;
+    uint_64 counters[METRICS];
+
+    metrics_snapshot(counters, &latency);
+
+    return counters[which];
+}
+
+static usize open_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    usize count = 0;
+
+    while (dir != NULL && readdir(dir) != NULL)
+        ++count;
+
+    if (dir != NULL)
+        closedir(dir);
+
+    return count;
+}
+
+/* A connection that fails leaves no descriptor behind, however many times it is retried */
+static void connect_refused(void) {
+    const usize before = open_fds();
+
+    for (uint_8 i = 0; i < 16; ++i)
+        CHECK(rh_client_new(TCP, "127.0.0.1", CLOSED_PORT) == NULL);
+
+    CHECK(open_fds() == before);
+}
+
+/* The client seals its memfd, the server refuses one that could still shrink under its mapping */
+static void shm_sealed(void) {
+    int fds[SHM_FDS];
+    struct shm_channel *channel = shm_channel_new(fds);
+    int seals;
+
+    if (!CHECK(channel != NULL))
+        return;
+
+    seals = fcntl(fds[0], F_GET_SEALS);
+    CHECK((seals & (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) == (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL));
+    shm_channel_destroy(channel);
+
+    fds[0] = memfd_create("csocket-test", MFD_CLOEXEC);
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (!CHECK(fds[0] >= 0 && ftruncate(fds[0], 1 << 20) == 0))
+        return;
+
+    errno = 0;
+    CHECK(shm_channel_attach(fds) == NULL && errno == EPROTO);
+}
+
+/* A client may write anything to the mapping: with every byte of it set, the server still takes the request and pushes
+ * its reply instead of spinning forever on what it finds there */
+static void shm_scribbled(void) {
+    const struct timespec retry = {.tv_sec = 0, .tv_nsec = 1000000};
+    const uint_16 a = 2, b = 3;
+    struct data *request = data_new(2);
+    struct value bytes_value = {0};
+    struct shm_channel *channel;
+    struct stat st;
+    byte reply[RH_FRAME_MAX];
+    usize reply_size = 0;
+    uint_64 deadline;
+    int fds[SHM_FDS], socket_fd;
+    void *rings;
+
+    data_push(request, UINT, sizeof(uint_16), &a);
+    data_push(request, UINT, sizeof(uint_16), &b);
+    marshall(request, "calc", "add", &bytes_value);
+    data_destroy(request);
+
+    if (!CHECK(NULL != (channel = shm_channel_new(fds)))) {
+        marshall_free(&bytes_value);
+        return;
+    }
+
+    if (CHECK(fstat(fds[0], &st) == 0 &&
+              MAP_FAILED != (rings = mmap(NULL, (usize) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)))) {
+        memset(rings, 0xFF, (usize) st.st_size);
+        munmap(rings, (usize) st.st_size);
+    }
+
+    if (CHECK((socket_fd = unix_connect(SHM_PATH)) >= 0) && CHECK(shm_send_fds(socket_fd, fds)) &&
+        CHECK(shm_push(channel, SHM_REQUESTS, bytes_value.value, bytes_value.size))) {
+        for (deadline = clock_now_ns() + 1000000000U; clock_now_ns() < deadline &&
+             0 == (reply_size = shm_pop(channel, SHM_REPLIES, reply));)
+            nanosleep(&retry, NULL);
+
+        CHECK(reply_size > 0);
+    }
+
+    if (socket_fd >= 0)
+        close(socket_fd);
+
+    shm_channel_destroy(channel);
+    marshall_free(&bytes_value);
+}
+
+/* Sends everything without blocking for more than a few seconds, however long the peer leaves it unread */
+static bool send_all(const int socket_fd, const byte *data, usize size) {
+    const struct timespec retry = {.tv_sec = 0, .tv_nsec = 1000000};
+    const uint_64 deadline = clock_now_ns() + 3000000000U;
+    ssize sent;
+
+    while (size > 0 && clock_now_ns() < deadline) {
+        if ((sent = send(socket_fd, data, size, MSG_DONTWAIT)) > 0) {
+            data += sent;
+            size -= (usize) sent;
+        } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        else
+            nanosleep(&retry, NULL);
+    }
+
+    return size == 0;
+}
+
+/* A client that pipelines many requests without reading the replies fills its socket: the reactor keeps serving the
+ * others, and closes it once more replies are waiting than the output of a connection holds */
+static void slow_reader(void) {
+    const struct timespec settle = {.tv_sec = 0, .tv_nsec = 200000000};
+    const struct timeval timeout = {.tv_sec = 3, .tv_usec = 0};
+    const uint_16 a = 2, b = 3;
+    rh_conn_ctx *conn_ctx = test_connect(UNIX, UNIX_PATH, 0);
+    struct data *request = data_new(2);
+    struct value bytes_value = {0};
+    byte *frames, reply[RH_FRAME_HEADER + RH_FRAME_MAX];
+    usize frame_size, replies = 0, buffered = 0;
+    int_32 result = 0;
+    uint_64 begin;
+    ssize received;
+    int slow = -1;
+
+    data_push(request, UINT, sizeof(uint_16), &a);
+    data_push(request, UINT, sizeof(uint_16), &b);
+    marshall(request, "calc", "add", &bytes_value);
+    data_destroy(request);
+
+    frame_size = RH_FRAME_HEADER + bytes_value.size;
+    frames = malloc(frame_size * PIPELINED);
+
+    for (usize i = 0; i < PIPELINED; ++i) {
+        frames[i * frame_size] = (byte) (bytes_value.size >> 8U);
+        frames[i * frame_size + 1] = (byte) bytes_value.size;
+        memcpy(frames + i * frame_size + RH_FRAME_HEADER, bytes_value.value, bytes_value.size);
+    }
+
+    if (CHECK(conn_ctx != NULL) && CHECK((slow = unix_connect(UNIX_PATH)) >= 0) &&
+        CHECK(send_all(slow, frames, frame_size * PIPELINED))) {
+        /* the replies fill the socket meanwhile */
+        nanosleep(&settle, NULL);
+        begin = clock_now_ns();
+
+        CHECK(test_call(conn_ctx, "mul", 6, 7));
+        CHECK(test_reply(conn_ctx, &result) && result == 42);
+        CHECK(clock_now_ns() - begin < 500000000U);
+
+        CHECK(setsockopt(slow, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+
+        /* counts whole frames, carrying a partial one over to the next read, up to the end of the connection */
+        while ((received = read(slow, reply + buffered, sizeof(reply) - buffered)) > 0) {
+            buffered += (usize) received;
+
+            while (buffered >= RH_FRAME_HEADER &&
+                   buffered >= (frame_size = RH_FRAME_HEADER + (usize) (reply[0] << 8U | reply[1]))) {
+                buffered -= frame_size;
+                memmove(reply, reply + frame_size, buffered);
+                ++replies;
+            }
+        }
+
+        CHECK(received == 0);
+        CHECK(replies > 0 && replies < PIPELINED);
+    }
+
+    if (slow >= 0)
+        close(slow);
+
+    if (conn_ctx != NULL)
+        rh_client_destroy(conn_ctx);
+
+    free(frames);
+    marshall_free(&bytes_value);
+}
+
+/* A client that connected but never sent its descriptors neither holds up the others nor its slot for long */
+static void shm_handshake(void) {
+    const struct timespec settle = {.tv_sec = 0, .tv_nsec = 50000000};
+    const struct timeval timeout = {.tv_sec = 3, .tv_usec = 0};
+    rh_conn_ctx *conn_ctx = test_connect(SHM, SHM_PATH, 0);
+    int_32 result = 0;
+    uint_64 begin;
+    byte probe;
+    int silent;
+
+    if (!CHECK(conn_ctx != NULL))
+        return;
+
+    CHECK(test_call(conn_ctx, "add", 1, 2));
+    CHECK(test_reply(conn_ctx, &result) && result == 3);
+
+    if (!CHECK((silent = unix_connect(SHM_PATH)) >= 0)) {
+        rh_client_destroy(conn_ctx);
+        return;
+    }
+
+    nanosleep(&settle, NULL);
+    begin = clock_now_ns();
+
+    CHECK(test_call(conn_ctx, "mul", 6, 7));
+    CHECK(test_reply(conn_ctx, &result) && result == 42);
+    CHECK(clock_now_ns() - begin < 500000000U);
+
+    CHECK(setsockopt(silent, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    CHECK(read(silent, &probe, sizeof(probe)) == 0);
+    CHECK(clock_now_ns() - begin < 2000000000U);
+
+    close(silent);
+    rh_client_destroy(conn_ctx);
+}
+
+/* A peer that keeps its end open once reaped is not waited for, the client kept busy meanwhile on the same reactor
+ * gets every reply in time */
+static void idle_reaped(void) {
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = 100000000};
+    const struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+    rh_conn_ctx *conn_ctx = test_connect(TCP, "127.0.0.1", TCP_PORT);
+    const uint_64 reaped = metric(METRIC_CONNECTIONS_REAPED);
+    uint_64 begin, slowest = 0;
+    int_32 result = 0;
+    byte probe;
+    int idle;
+
+    if (!CHECK(conn_ctx != NULL))
+        return;
+
+    if (!CHECK((idle = tcp_connect(TCP_PORT)) >= 0)) {
+        rh_client_destroy(conn_ctx);
+        return;
+    }
+
+    for (uint_16 i = 0; i < IDLE_TIMEOUT_S * 15; ++i) {
+        nanosleep(&pause, NULL);
+        begin = clock_now_ns();
+
+        CHECK(test_call(conn_ctx, "add", i, 1));
+        CHECK(test_reply(conn_ctx, &result) && result == i + 1);
+
+        if (clock_now_ns() - begin > slowest)
+            slowest = clock_now_ns() - begin;
+    }
+
+    CHECK(slowest < 200000000U);
+    CHECK(metric(METRIC_CONNECTIONS_REAPED) == reaped + 1);
+    CHECK(setsockopt(idle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    CHECK(read(idle, &probe, sizeof(probe)) == 0);
+
+    close(idle);
+    rh_client_destroy(conn_ctx);
+}
+
+void test_rh(void) {
+    connect_refused();
+
+    test_server(UNIX, 0, UNIX_PATH, 1, false);
+    slow_reader();
+
+    test_server(SHM, 0, SHM_PATH, 1, false);
+
+    shm_sealed();
+    shm_handshake();
+    shm_scribbled();
+
+    /* only for the servers started from now on, the SHM one is already up */
+    rh_server_set_idle_timeout(IDLE_TIMEOUT_S);
+    test_server(TCP, TCP_PORT, NULL, 1, false);
+
+    idle_reaped();
+}
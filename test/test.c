@@ -0,0 +1,240 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#define _POSIX_C_SOURCE 200112L
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+#include "server.h"
+#include "i/invoker.h"
+#include "m/marshaller.h"
+#include "stats/clock.h"
+
+/* A delay call waiting for its reply, in the order they are due */
+struct delayed {
+    uint_64 due;
+    int_32 result;
+    service_reply *req;
+    struct delayed *next;
+};
+
+static uint_32 checks = 0;
+static uint_32 failures = 0;
+static pthread_once_t delays_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t delays_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delays_cond;
+static struct delayed *delays = NULL;
+
+bool test_check(const bool passed, const char *const condition, const char *const file, const int line) {
+    __atomic_fetch_add(&checks, 1, __ATOMIC_RELAXED);
+
+    if (!passed) {
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+    }
+
+    return passed;
+}
+
+struct server_options {
+    enum protocol protocol;
+    uint_16 port;
+    const char *path;
+    uint_8 threads_num;
+    bool coroutines;
+};
+
+/* Replies to the delay calls as they fall due, long after their method returned and from another thread than the one
+ * that ran it */
+static __attribute__((noreturn)) void *reply_delays(void *const arg __attribute__((unused))) {
+    struct delayed *delayed;
+    struct data *reply;
+    struct timespec due;
+
+    for (;;) {
+        pthread_mutex_lock(&delays_mutex);
+
+        while (delays == NULL || delays->due > clock_now_ns()) {
+            if (delays == NULL)
+                pthread_cond_wait(&delays_cond, &delays_mutex);
+            else {
+                due.tv_sec = (time_t) (delays->due / 1000000000U);
+                due.tv_nsec = (long) (delays->due % 1000000000U);
+                pthread_cond_timedwait(&delays_cond, &delays_mutex, &due);
+            }
+        }
+
+        delayed = delays;
+        delays = delayed->next;
+        pthread_mutex_unlock(&delays_mutex);
+
+        reply = data_new(1);
+        data_push(reply, INT, sizeof(int_32), &delayed->result);
+        invoker_reply(delayed->req, reply);
+
+        data_destroy(reply);
+        free(delayed);
+    }
+}
+
+static void start_delays(void) {
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&delays_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_create(&thread, NULL, reply_delays, NULL);
+    pthread_detach(thread);
+}
+
+/* calc.delay(a, b) replies a after b ms without holding a worker meanwhile */
+static void calc_delay(const data *const d, service_reply *const req) {
+    const value *v_a = data_get_value(d, 0), *v_b = data_get_value(d, 1);
+    struct delayed *delayed, **link;
+
+    if (v_a == NULL || v_a->type != UINT || v_a->size != 2 || v_b == NULL || v_b->type != UINT || v_b->size != 2) {
+        invoker_reply(req, NULL);
+        return;
+    }
+
+    delayed = malloc(sizeof(struct delayed));
+    delayed->due = clock_now_ns() + (uint_64) *(uint_16 *) v_b->value * 1000000U;
+    delayed->result = *(uint_16 *) v_a->value;
+    delayed->req = req;
+
+    pthread_mutex_lock(&delays_mutex);
+
+    for (link = &delays; *link != NULL && (*link)->due <= delayed->due; link = &(*link)->next)
+        continue;
+
+    delayed->next = *link;
+    *link = delayed;
+
+    pthread_cond_signal(&delays_cond);
+    pthread_mutex_unlock(&delays_mutex);
+}
+
+static __attribute__((noreturn)) void *run(void *const arg) {
+    const struct server_options *options = arg;
+    struct service *service = calc_service_new(CALC_METHODS + 1, 2);
+    struct invoker *invoker = invoker_new(options->protocol, options->port, options->path, options->threads_num, 0,
+                                          options->coroutines);
+
+    /* a delay keeps its caller waiting anyway and holds a pending reply: it goes after the arithmetic and counts double
+     * against the share of its connection */
+    service_add_async_method(service, "delay", calc_delay, METHOD_WEIGHT(2));
+    pthread_once(&delays_once, start_delays);
+
+    invoker_run(invoker, service);
+}
+
+void test_server(const enum protocol protocol, const uint_16 port, const char *const path, const uint_8 threads_num,
+                 const bool coroutines) {
+    struct server_options *options = malloc(sizeof(struct server_options));
+    pthread_t thread;
+
+    options->protocol = protocol;
+    options->port = port;
+    options->path = path;
+    options->threads_num = threads_num;
+    options->coroutines = coroutines;
+
+    pthread_create(&thread, NULL, run, options);
+    pthread_detach(thread);
+}
+
+rh_conn_ctx *test_connect(const enum protocol protocol, const char *const host, const uint_16 port) {
+    const struct timespec retry = {.tv_sec = 0, .tv_nsec = 10000000};
+    const uint_64 deadline = clock_now_ns() + RH_TIMEOUT_MS * UINT64_C(1000000);
+    rh_conn_ctx *conn_ctx;
+
+    while (NULL == (conn_ctx = rh_client_new(protocol, host, port)) && clock_now_ns() < deadline)
+        nanosleep(&retry, NULL);
+
+    return conn_ctx;
+}
+
+bool test_call(rh_conn_ctx *const conn_ctx, const char *const method, const uint_16 a, const uint_16 b) {
+    struct data *request = data_new(2);
+    struct value bytes_value = {0};
+    bool sent;
+
+    data_push(request, UINT, sizeof(uint_16), &a);
+    data_push(request, UINT, sizeof(uint_16), &b);
+    marshall(request, "calc", method, &bytes_value);
+
+    sent = rh_send_to_server(conn_ctx, bytes_value.value, bytes_value.size);
+
+    marshall_free(&bytes_value);
+    data_destroy(request);
+
+    return sent;
+}
+
+bool test_reply(rh_conn_ctx *const conn_ctx, int_32 *const result) {
+    struct data *reply = NULL;
+    struct value bytes_value = {.type = BYTES};
+    const struct value *value;
+    rh_server_msg *msg;
+    bool valid;
+
+    if (NULL == (msg = rh_receive_from_server(conn_ctx)))
+        return false;
+
+    bytes_value.size = msg->data_size;
+    bytes_value.value = msg->data;
+    unmarshall(&bytes_value, NULL, NULL, &reply);
+
+    if ((valid = reply != NULL && data_size(reply) == 1 && NULL != (value = data_get_value(reply, 0)) &&
+                 value->type == INT && value->size == sizeof(int_32)))
+        *result = *(int_32 *) value->value;
+
+    if (reply != NULL)
+        data_destroy(reply);
+
+    rh_server_msg_destroy(msg);
+
+    return valid;
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} suites[] = {
+        {"bm",        test_bm},
+        {"invoker",   test_invoker},
+        {"coroutine", test_coroutine},
+        {"rh",        test_rh},
+        {"queue",     test_queue}
+};
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    log_silence();
+
+    for (usize i = 0; i < sizeof(suites) / sizeof(suites[0]); ++i) {
+        bool selected = argc < 2;
+
+        for (int_32 j = 1; j < argc; ++j)
+            selected = selected || strcmp(argv[j], suites[i].name) == 0;
+
+        if (selected) {
+            uint_32 failed = failures;
+
+            suites[i].run();
+            printf("%-12s %s\n", suites[i].name, failures == failed ? "ok" : "FAILED");
+        }
+    }
+
+    printf("%u checks, %u failed\n", checks, failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
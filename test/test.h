@@ -0,0 +1,37 @@
+/* csocket: Copyright (c) 2020 Wendell Júnior - This code is licensed under MIT license (see LICENSE for details) */
+#ifndef CSOCKET_TEST_H
+#define CSOCKET_TEST_H
+
+#include "types/primitive.h"
+#include "rh/types.h"
+#include "rh/client.h"
+
+/* Records a failed check with its location and carries on, so that one run reports every broken expectation */
+#define CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+bool test_check(bool passed, const char *condition, const char *file, int line);
+
+/* Runs the calc server of the csocket binary from a thread of its own, for the rest of the run, with one more method
+ * for the tests: delay(a, b) replies a after b ms, from another thread once the method returned */
+void test_server(enum protocol, uint_16 port, const char *path, uint_8 threads_num, bool coroutines);
+
+/* Connects to a server that may still be starting, giving up after RH_TIMEOUT_MS */
+rh_conn_ctx *test_connect(enum protocol, const char *host, uint_16 port);
+
+/* Calls a calc method taking (uint_16, uint_16) without waiting for the reply */
+bool test_call(rh_conn_ctx *, const char *method, uint_16 a, uint_16 b);
+
+/* Takes the next reply, which has to hold a single INT */
+bool test_reply(rh_conn_ctx *, int_32 *result);
+
+void test_bm(void);
+
+void test_invoker(void);
+
+void test_coroutine(void);
+
+void test_rh(void);
+
+void test_queue(void);
+
+#endif /* CSOCKET_TEST_H */